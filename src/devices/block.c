@@ -139,6 +139,70 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   block->write_cnt++;
 }
 
+/* Verifies that the CNT sectors starting at SECTOR are a valid
+   range within BLOCK.  Panics if not. */
+static void
+check_sector_range (struct block *block, block_sector_t sector,
+                    block_sector_t cnt)
+{
+  check_sector (block, sector);
+  if (cnt > block->size - sector)
+    PANIC ("Access past end of device %s (sector=%"PRDSNu", cnt=%"PRDSNu", "
+           "size=%"PRDSNu")\n", block_name (block), sector, cnt, block->size);
+}
+
+/* Reads CNT contiguous sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Devices that support it transfer the whole run with a
+   single command.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     block_sector_t cnt, void *buffer_)
+{
+  uint8_t *buffer = buffer_;
+  block_sector_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector_range (block, sector, cnt);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        buffer + i * BLOCK_SECTOR_SIZE);
+  block->read_cnt += cnt;
+}
+
+/* Writes CNT contiguous sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Devices that support it transfer the whole run with a single
+   command.  Returns after the block device has acknowledged
+   receiving the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      block_sector_t cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  block_sector_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector_range (block, sector, cnt);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         buffer + i * BLOCK_SECTOR_SIZE);
+  block->write_cnt += cnt;
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
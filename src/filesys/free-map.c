@@ -4,6 +4,9 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
@@ -45,6 +48,10 @@ void
 free_map_release (block_sector_t sector, size_t cnt)
 {
   ASSERT (bitmap_all (free_map, sector, cnt));
+#ifdef VM
+  /* Executable pages cached from these sectors are gone for good */
+  frame_exec_invalidate (sector, cnt);
+#endif
   bitmap_set_multiple (free_map, sector, cnt, false);
   bitmap_write (free_map, free_map_file);
 }
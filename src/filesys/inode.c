@@ -6,6 +6,9 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -221,8 +224,13 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Read the whole run of full sectors directly into
+             caller's buffer, an inode's sectors are contiguous. */
+          off_t run_left = size < inode_left ? size : inode_left;
+          block_sector_t sector_cnt = run_left / BLOCK_SECTOR_SIZE;
+          block_read_multiple (fs_device, sector_idx, sector_cnt,
+                               buffer + bytes_read);
+          chunk_size = sector_cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
@@ -282,8 +290,16 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Write the whole run of full sectors directly to disk,
+             an inode's sectors are contiguous. */
+          off_t run_left = size < inode_left ? size : inode_left;
+          block_sector_t sector_cnt = run_left / BLOCK_SECTOR_SIZE;
+#ifdef VM
+          frame_exec_invalidate (sector_idx, sector_cnt);
+#endif
+          block_write_multiple (fs_device, sector_idx, sector_cnt,
+                                buffer + bytes_written);
+          chunk_size = sector_cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
@@ -303,6 +319,9 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
           else
             memset (bounce, 0, BLOCK_SECTOR_SIZE);
           memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
+#ifdef VM
+          frame_exec_invalidate (sector_idx, 1);
+#endif
           block_write (fs_device, sector_idx, bounce);
         }
 
@@ -0,0 +1,159 @@
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+#include "../debug.h"
+
+/* Hash table of recent 3-byte sequences, in the caller's work
+   area.  Each entry is the offset of a sequence plus 1, or 0. */
+#define HASH_BITS 10
+#define HASH_CNT (1 << HASH_BITS)
+
+/* Limits of the encoding. */
+#define MAX_LITERAL 32                  /* Literals per run. */
+#define MIN_MATCH 3                     /* Shortest back-reference. */
+#define MAX_MATCH (2 + 7 + 255)         /* Longest back-reference. */
+#define MAX_DISTANCE (1 << 13)          /* Farthest back-reference. */
+
+static inline unsigned
+hash3 (const uint8_t *p) 
+{
+  unsigned v = (p[0] << 16) | (p[1] << 8) | p[2];
+  return ((v * 2654435761u) >> (32 - HASH_BITS)) & (HASH_CNT - 1);
+}
+
+/* Appends the literal bytes in [START, END) to the output at
+   *OP, which may not go beyond OP_END.  Returns false if the
+   output is full. */
+static bool
+put_literals (const uint8_t *start, const uint8_t *end,
+              uint8_t **op, uint8_t *op_end) 
+{
+  while (start < end) 
+    {
+      size_t cnt = end - start < MAX_LITERAL ? end - start : MAX_LITERAL;
+      if ((size_t) (op_end - *op) < cnt + 1)
+        return false;
+      *(*op)++ = cnt - 1;
+      memcpy (*op, start, cnt);
+      *op += cnt;
+      start += cnt;
+    }
+  return true;
+}
+
+/* Compresses the SRC_SIZE bytes at SRC into the DST_SIZE bytes
+   at DST, using the LZ_WORK_SIZE bytes at WORK as scratch
+   space.  Returns the size of the compressed data, or 0 if it
+   does not fit in DST_SIZE bytes. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_size, void *work) 
+{
+  const uint8_t *src = src_;
+  const uint8_t *ip = src;
+  const uint8_t *ip_end = src + src_size;
+  const uint8_t *literal = src;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + dst_size;
+  uint16_t *htab = work;
+
+  ASSERT (src_size < UINT16_MAX);
+  ASSERT (HASH_CNT * sizeof *htab <= LZ_WORK_SIZE);
+
+  memset (htab, 0, HASH_CNT * sizeof *htab);
+  while (ip_end - ip >= MIN_MATCH) 
+    {
+      unsigned h = hash3 (ip);
+      const uint8_t *ref = htab[h] != 0 ? src + htab[h] - 1 : NULL;
+
+      htab[h] = ip - src + 1;
+      if (ref != NULL && ip - ref <= MAX_DISTANCE
+          && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) 
+        {
+          size_t max = ip_end - ip < MAX_MATCH ? ip_end - ip : MAX_MATCH;
+          size_t distance = ip - ref - 1;
+          size_t len = MIN_MATCH;
+
+          while (len < max && ref[len] == ip[len])
+            len++;
+
+          if (!put_literals (literal, ip, &op, op_end)
+              || op_end - op < 3)
+            return 0;
+          if (len - 2 < 7)
+            *op++ = ((len - 2) << 5) | (distance >> 8);
+          else 
+            {
+              *op++ = (7 << 5) | (distance >> 8);
+              *op++ = len - 2 - 7;
+            }
+          *op++ = distance & 0xff;
+
+          ip += len;
+          literal = ip;
+        }
+      else
+        ip++;
+    }
+
+  if (!put_literals (literal, ip_end, &op, op_end))
+    return 0;
+  return op - dst;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, produced by
+   lz_compress(), into the DST_SIZE bytes at DST.  Returns true
+   if the data was well formed and decompressed to exactly
+   DST_SIZE bytes. */
+bool
+lz_decompress (const void *src_, size_t src_size,
+               void *dst_, size_t dst_size) 
+{
+  const uint8_t *ip = src_;
+  const uint8_t *ip_end = ip + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *op_end = dst + dst_size;
+
+  while (ip < ip_end) 
+    {
+      unsigned c = *ip++;
+
+      if (c < MAX_LITERAL) 
+        {
+          size_t cnt = c + 1;
+          if ((size_t) (ip_end - ip) < cnt || (size_t) (op_end - op) < cnt)
+            return false;
+          memcpy (op, ip, cnt);
+          ip += cnt;
+          op += cnt;
+        }
+      else 
+        {
+          size_t len = c >> 5;
+          size_t distance;
+          const uint8_t *ref;
+
+          if (len == 7) 
+            {
+              if (ip >= ip_end)
+                return false;
+              len += *ip++;
+            }
+          len += 2;
+          if (ip >= ip_end)
+            return false;
+          distance = ((c & 0x1f) << 8) + *ip++ + 1;
+
+          ref = op - distance;
+          if (distance > (size_t) (op - dst) || (size_t) (op_end - op) < len)
+            return false;
+
+          /* The reference may overlap the output, so byte by byte. */
+          while (len-- > 0)
+            *op++ = *ref++;
+        }
+    }
+  return op == op_end;
+}
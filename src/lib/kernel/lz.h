@@ -0,0 +1,31 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+/* LZ77 compression.
+
+   A small, fast compressor in the style of LZF, meant for pages
+   of memory rather than files: it favors speed over ratio, needs
+   no allocation, and works on buffers of up to 64 kB.
+
+   The compressed stream is a sequence of runs, each introduced
+   by a control byte C:
+
+     - C < 32: C + 1 literal bytes follow.
+
+     - Otherwise, a back-reference to earlier output.  Its length,
+       minus 2, is C >> 5, or 7 plus the next byte if C >> 5 is 7.
+       Its distance, minus 1, is (C & 0x1f) << 8 plus the byte
+       after that. */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Size of the scratch area that lz_compress() needs. */
+#define LZ_WORK_SIZE 2048
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, void *work);
+bool lz_decompress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
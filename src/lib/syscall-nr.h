@@ -28,7 +28,12 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_FORK,                   /* Clone this process. */
+    SYS_MSYNC,                  /* Write back a memory mapping. */
+    SYS_MADVISE                 /* Give advice about use of memory. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -2,6 +2,7 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <debug.h>
 
 /* Process identifier. */
@@ -12,6 +13,13 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Advice to madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect page references in random order. */
+#define MADV_SEQUENTIAL 2       /* Expect page references in order. */
+#define MADV_WILLNEED 3         /* Will need these pages soon. */
+#define MADV_DONTNEED 4         /* Done with these pages for now. */
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -45,4 +53,9 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+pid_t fork (void);
+bool msync (mapid_t);
+bool madvise (void *addr, size_t length, int advice);
+
 #endif /* lib/user/syscall.h */
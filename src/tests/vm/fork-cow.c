@@ -0,0 +1,45 @@
+/* Forks a child that overwrites a 256 kB buffer and its stack,
+   and verifies that the parent's copies are left untouched. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (256 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  char stk[1024];
+  pid_t child;
+  size_t i;
+
+  memset (buf, 0x5a, sizeof buf);
+  memset (stk, 0x5a, sizeof stk);
+
+  child = fork ();
+  if (child == 0)
+    {
+      /* Child: write over everything, and check its own copy. */
+      memset (buf, 0xa5, sizeof buf);
+      memset (stk, 0xa5, sizeof stk);
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) 0xa5)
+          exit (1);
+      exit (0x42);
+    }
+
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 0x42, "wait for child");
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu != 0x5a", i);
+  for (i = 0; i < sizeof stk; i++)
+    if (stk[i] != 0x5a)
+      fail ("stack byte %zu != 0x5a", i);
+  msg ("parent's memory intact");
+}
@@ -0,0 +1,37 @@
+/* Maps a file and forks a child, which must not inherit the
+   mapping, so touching it kills the child.  Verifies that the
+   parent's mapping is left intact. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  pid_t child;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+
+  child = fork ();
+  if (child == 0)
+    {
+      /* Child: the mapped address must fault. */
+      exit (*(volatile int *) ACTUAL);
+    }
+
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == -1, "wait for child");
+
+  if (memcmp (ACTUAL, sample, strlen (sample)))
+    fail ("read of mmap'd file reported bad data");
+  msg ("parent's mapping intact");
+  munmap (map);
+}
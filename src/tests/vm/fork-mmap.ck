@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-mmap) begin
+(fork-mmap) open "sample.txt"
+(fork-mmap) mmap "sample.txt"
+(fork-mmap) fork
+(fork-mmap) wait for child
+(fork-mmap) parent's mapping intact
+(fork-mmap) end
+EOF
+pass;
@@ -0,0 +1,70 @@
+/* Gives each kind of advice about a memory mapping, a page of
+   uninitialized data and a page of stack, and checks that their
+   contents are kept or dropped as advised. */
+
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+#define PAGE_SIZE 4096
+
+static char bss_obj[3 * PAGE_SIZE];
+
+/* Drop the page at PAGE, after filling it, and check that it
+   reads back as zeros. */
+static void
+check_dropped (char *page, const char *name)
+{
+  size_t i;
+
+  memset (page, 0xcc, PAGE_SIZE);
+  CHECK (madvise (page, PAGE_SIZE, MADV_DONTNEED), "madvise dontneed %s", name);
+  for (i = 0; i < PAGE_SIZE; i++)
+    if (page[i] != 0)
+      fail ("byte %zu of %s page has value %02hhx (should be 0)",
+            i, name, page[i]);
+}
+
+void
+test_main (void)
+{
+  char stack_obj[3 * PAGE_SIZE];
+  char buf[1024];
+  int handle;
+  mapid_t map;
+
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+
+  /* Data written to a mapping survives its pages being dropped. */
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_SEQUENTIAL), "madvise sequential");
+  memcpy (ACTUAL, sample, strlen (sample));
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_DONTNEED), "madvise dontneed");
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare file data against written data");
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_WILLNEED), "madvise willneed");
+  CHECK (!memcmp (ACTUAL, sample, strlen (sample)),
+         "compare mapped data against written data");
+  CHECK (madvise (ACTUAL, PAGE_SIZE, MADV_RANDOM), "madvise random");
+  CHECK (!memcmp (ACTUAL, sample, strlen (sample)),
+         "compare mapped data again");
+
+  /* Anonymous data is lost. */
+  check_dropped ((char *) ROUND_UP ((uintptr_t) bss_obj, PAGE_SIZE), "data");
+  check_dropped ((char *) ROUND_UP ((uintptr_t) stack_obj, PAGE_SIZE),
+                 "stack");
+
+  CHECK (!madvise (ACTUAL + 1, PAGE_SIZE, MADV_WILLNEED),
+         "madvise of unaligned address fails");
+  CHECK (!madvise (ACTUAL, PAGE_SIZE, 42), "madvise with bad advice fails");
+
+  munmap (map);
+  close (handle);
+}
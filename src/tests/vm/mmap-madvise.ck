@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) create "sample.txt"
+(mmap-madvise) open "sample.txt"
+(mmap-madvise) mmap "sample.txt"
+(mmap-madvise) madvise sequential
+(mmap-madvise) madvise dontneed
+(mmap-madvise) compare file data against written data
+(mmap-madvise) madvise willneed
+(mmap-madvise) compare mapped data against written data
+(mmap-madvise) madvise random
+(mmap-madvise) compare mapped data again
+(mmap-madvise) madvise dontneed data
+(mmap-madvise) madvise dontneed stack
+(mmap-madvise) madvise of unaligned address fails
+(mmap-madvise) madvise with bad advice fails
+(mmap-madvise) end
+EOF
+pass;
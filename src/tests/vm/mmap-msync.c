@@ -0,0 +1,37 @@
+/* Writes to a file through a mapping, flushes the mapping with
+   msync, then reads the data in the file back using the read
+   system call while the file is still mapped. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((void *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle;
+  mapid_t map;
+  char buf[1024];
+
+  /* Write file via mmap, and flush it. */
+  CHECK (create ("sample.txt", strlen (sample)), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK ((map = mmap (handle, ACTUAL)) != MAP_FAILED, "mmap \"sample.txt\"");
+  memcpy (ACTUAL, sample, strlen (sample));
+  CHECK (msync (map), "msync \"sample.txt\"");
+
+  /* Read back via read(), the mapping is still in place. */
+  read (handle, buf, strlen (sample));
+  CHECK (!memcmp (buf, sample, strlen (sample)),
+         "compare read data against written data");
+  CHECK (!memcmp (ACTUAL, sample, strlen (sample)),
+         "compare mapped data against written data");
+  CHECK (!msync (map + 1), "msync of an unknown mapping fails");
+
+  munmap (map);
+  close (handle);
+}
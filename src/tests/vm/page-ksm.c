@@ -0,0 +1,55 @@
+/* Fills two 128 kB buffers and a stack buffer with the same
+   contents, which the merge daemon shares between them while the
+   test keeps checking them, then writes over one buffer and
+   verifies the others are left untouched.  page-ksm.ck checks the
+   kernel's statistics for pages merged and then unmerged by the
+   write. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+#define ROUNDS 1000
+
+static char buf1[SIZE];
+static char buf2[SIZE];
+
+static char
+pattern (size_t i)
+{
+  return (i % 4096) * 7 % 251;
+}
+
+void
+test_main (void)
+{
+  char stk[4096];
+  size_t i;
+  int round;
+
+  for (i = 0; i < SIZE; i++)
+    buf1[i] = buf2[i] = pattern (i);
+  for (i = 0; i < sizeof stk; i++)
+    stk[i] = pattern (i);
+  msg ("fill buffers");
+
+  /* Give the merge daemon time to find the identical pages. */
+  for (round = 0; round < ROUNDS; round++)
+    if (memcmp (buf1, buf2, SIZE) || memcmp (buf1, stk, sizeof stk))
+      fail ("buffers differ in round %d", round);
+  msg ("compare buffers");
+
+  memset (buf1, 0xa5, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (buf1[i] != (char) 0xa5)
+      fail ("buf1 byte %zu != 0xa5", i);
+  for (i = 0; i < SIZE; i++)
+    if (buf2[i] != pattern (i))
+      fail ("buf2 byte %zu changed", i);
+  for (i = 0; i < sizeof stk; i++)
+    if (stk[i] != pattern (i))
+      fail ("stack byte %zu changed", i);
+  msg ("write breaks sharing");
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-ksm) begin
+(page-ksm) fill buffers
+(page-ksm) compare buffers
+(page-ksm) write breaks sharing
+(page-ksm) end
+EOF
+
+# The write must have gone through merged pages.
+my (@output) = read_text_file ("$test.output");
+my ($stats) = grep (/^Merging: /, @output);
+fail "missing merging statistics\n" if !defined $stats;
+my ($merged, $unmerged) = $stats =~ /(\d+) merged, (\d+) unmerged/
+  or fail "malformed merging statistics: $stats\n";
+fail "no pages were merged\n" if $merged == 0;
+fail "no merged page was written\n" if $unmerged == 0;
+pass;
@@ -24,6 +24,8 @@
 #include "threads/thread.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/pageout.h"
+#include "vm/ksm.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -43,6 +45,11 @@
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* CR4 Page Global Enable bit, and the CPUID feature flag (in EDX)
+   telling whether the CPU has it. */
+#define CR4_PGE 0x00000080
+#define CPUID_PGE 0x00002000
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -56,11 +63,27 @@ static const char *swap_bdev_name;
 #endif
 #endif /* FILESYS */
 
+#ifdef VM
+/* -wl, -wh: Free user page watermarks of the pageout daemon. */
+static size_t pageout_low = PAGEOUT_LOW_DEFAULT;
+static size_t pageout_high = PAGEOUT_HIGH_DEFAULT;
+
+/* -zswap: Pages of memory for the compressed swap cache. */
+static size_t swap_cache_pages = SWAP_CACHE_DEFAULT;
+
+/* -rss: Soft limit on resident pages of each process. */
+static size_t rss_limit = RSS_LIMIT_NONE;
+
+/* -ksm: Pages scanned for merging each time. */
+static size_t ksm_pages = KSM_PAGES_DEFAULT;
+#endif
+
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static bool cpu_has_pge (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -130,6 +153,12 @@ main (void)
 #endif
   sup_pt_init ();
   swap_init ();
+#ifdef VM
+  swap_cache_init (swap_cache_pages);
+  frame_rss_init (rss_limit);
+  pageout_init (pageout_low, pageout_high);
+  ksm_init (ksm_pages);
+#endif
 
   printf ("Boot complete.\n");
   
@@ -181,7 +210,9 @@ paging_init (void)
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      /* Kernel mappings are the same in every page directory,
+         so they are global and survive process switches. */
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | PTE_G;
     }
 
   /* Store the physical address of the page directory into CR3
@@ -190,6 +221,28 @@ paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  /* Honor the global bit, if the CPU supports it.  See [IA32-v3a]
+     3.12 "Translation Lookaside Buffers (TLBs)". */
+  if (cpu_has_pge ())
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE));
+    }
+}
+
+/* Returns true if the CPU supports global pages, according to
+   CPUID.  See [IA32-v2a] "CPUID--CPU Identification". */
+static bool
+cpu_has_pge (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  return (edx & CPUID_PGE) != 0;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -263,6 +316,19 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-wl"))
+        pageout_low = atoi (value);
+      else if (!strcmp (name, "-wh"))
+        pageout_high = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        swap_cache_pages = atoi (value);
+      else if (!strcmp (name, "-rss"))
+        rss_limit = !strcmp (value, "ws") ? RSS_LIMIT_WS
+                    : (size_t) atoi (value);
+      else if (!strcmp (name, "-ksm"))
+        ksm_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -385,6 +451,15 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -wl=COUNT          Start paging out below COUNT free user pages.\n"
+          "  -wh=COUNT          Stop paging out at COUNT free user pages.\n"
+          "  -zswap=COUNT       Compress up to COUNT pages of swap in memory.\n"
+          "  -rss=COUNT|ws      Limit resident pages of each process softly to\n"
+          "                     COUNT, or to its working set.\n"
+          "  -ksm=COUNT         Merge identical pages, scanning COUNT pages\n"
+          "                     every 100 ms.\n"
 #endif
           );
   shutdown_power_off ();
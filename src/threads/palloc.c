@@ -2,6 +2,7 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -9,7 +10,11 @@
 #include <string.h>
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/pageout.h"
+#endif
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
@@ -23,22 +28,93 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Its free pages make up
+   blocks of 2**ORDER pages, aligned on their size relative to the
+   base of the pool, on one free list per order.  A request takes
+   the smallest block large enough, splitting larger blocks in
+   halves as needed, and gives back the pages of the block it
+   does not use.  Freed pages join their free "buddy", the other
+   half of the block they were split from, into ever larger
+   blocks.  Both take time logarithmic in the size of the pool.
+   A free block keeps its list element in its first page.
+
+   The idle thread zeroes free pages while nothing else is ready
+   to run, see palloc_zero_idle(), so most PAL_ZERO requests for
+   a single page, such as those of page faults, get a page that
+   is already zero.  Zeroed pages are kept apart from the free
+   lists, and go back to them if a request finds no block large
+   enough.
+
+   The split between the pools is not fixed.  A pool out of pages
+   borrows from the other one, as long as that leaves the other
+   pool a quarter of its pages free.  Pages go back to the pool
+   they came from when freed.  User pages lent by the kernel pool
+   are taken back by the pageout daemon once the kernel pool runs
+   short of its own reserve, see palloc_kernel_short(). */
+
+/* Number of block orders, from single pages up to blocks of
+   2**(PALLOC_ORDERS - 1) pages. */
+#define PALLOC_ORDERS 20
+
+/* Order of a page that does not start a free block. */
+#define NO_BLOCK 0xff
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    uint8_t *orders;                    /* Order of the free block
+                                           starting at each page,
+                                           or NO_BLOCK. */
+    struct list free_lists[PALLOC_ORDERS]; /* Free blocks by order. */
+    size_t block_cnts[PALLOC_ORDERS];   /* # of blocks in each list. */
+    size_t free_cnt;                    /* # of free pages, zeroed
+                                           pages included. */
+    size_t *zero_pages;                 /* Stack of free pages
+                                           known to be zero. */
+    size_t zero_cnt;                    /* # of pages in zero_pages. */
+    struct bitmap *lent_map;            /* Bitmap of pages lent to
+                                           the other pool. */
+    size_t lent_cnt;                    /* # of pages lent. */
+    size_t reserve;                     /* # of free pages kept
+                                           from the other pool. */
+    size_t page_cnt;                    /* # of pages. */
+    const char *name;                   /* For statistics. */
     uint8_t *base;                      /* Base of pool. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Whether the kernel pool lends pages to the user pool, unless
+   user memory was limited explicitly. */
+static bool lend_to_user;
+
+/* Statistics. */
+static long long zero_hit_cnt;          /* # of PAL_ZERO requests
+                                           served zeroed pages. */
+static long long zero_miss_cnt;         /* # of PAL_ZERO requests
+                                           zeroed on demand. */
+static long long zero_idle_cnt;         /* # of pages zeroed while
+                                           idle. */
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void *pool_get (struct pool *, enum palloc_flags, size_t page_cnt,
+                       bool lend);
+static size_t pages_alloc (struct pool *, size_t page_cnt);
+static void pages_free (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t block_alloc (struct pool *, unsigned order);
+static void block_free (struct pool *, size_t page_idx, unsigned order);
+static void block_insert (struct pool *, size_t page_idx, unsigned order);
+static void block_remove (struct pool *, size_t page_idx);
+static bool zero_free_page (struct pool *);
+static void zero_drain (struct pool *);
+static void print_pool_stats (const struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,51 +135,47 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+  lend_to_user = user_page_limit == SIZE_MAX;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   otherwise from the kernel pool, or else borrowed from the other
+   pool if it can spare them.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
-  struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  bool user = (flags & PAL_USER) != 0;
   void *pages;
-  size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  pages = pool_get (user ? &user_pool : &kernel_pool, flags, page_cnt,
+                    false);
+  if (pages == NULL && (!user || lend_to_user))
+    pages = pool_get (user ? &kernel_pool : &user_pool, flags, page_cnt,
+                      true);
 
-  if (pages != NULL) 
-    {
-      if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
-    }
-  else 
-    {
-      if (flags & PAL_ASSERT)
-        PANIC ("palloc_get: out of pages");
-    }
+  if (pages == NULL && (flags & PAL_ASSERT))
+    PANIC ("palloc_get: out of pages");
 
+#ifdef VM
+  /* Have the pageout daemon take back what the kernel pool lent. */
+  if (!user && palloc_kernel_short ())
+    pageout_check ();
+#endif
   return pages;
 }
 
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
-   otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
+   otherwise from the kernel pool, or else borrowed from the other
+   pool.  If PAL_ZERO is set in FLAGS,
    then the page is filled with zeros.  If no pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
@@ -137,8 +209,16 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  lock_acquire (&pool->lock);
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (pool->lent_cnt > 0)
+    {
+      pool->lent_cnt -= bitmap_count (pool->lent_map, page_idx, page_cnt,
+                                      true);
+      bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, false);
+    }
+  pages_free (pool, page_idx, page_cnt);
+  lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +228,102 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes a free page, of the user pool first, so a later
+   PAL_ZERO request need not.  Called by the idle thread, which
+   must never block, so a busy pool is left alone.  Returns false
+   if no page was zeroed. */
+bool
+palloc_zero_idle (void)
+{
+  return zero_free_page (&user_pool) || zero_free_page (&kernel_pool);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  printf ("Palloc: %lld zeroed pages handed out, %lld zeroed on demand, "
+          "%lld zeroed while idle\n",
+          zero_hit_cnt, zero_miss_cnt, zero_idle_cnt);
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
+/* Returns the number of pages that may hold user pages, those of
+   the user pool and those the kernel pool may lend it, with the
+   pool metadata in between. */
+size_t
+palloc_user_page_cnt (void)
+{
+  return pg_no (user_pool.base) + user_pool.page_cnt
+         - pg_no (kernel_pool.base);
+}
+
+/* Returns the number of free pages for user pages, those of the
+   user pool and those the kernel pool can spare. */
+size_t
+palloc_user_free_cnt (void)
+{
+  size_t cnt;
+
+  lock_acquire (&user_pool.lock);
+  cnt = user_pool.free_cnt;
+  lock_release (&user_pool.lock);
+
+  if (lend_to_user)
+    {
+      lock_acquire (&kernel_pool.lock);
+      if (kernel_pool.free_cnt > kernel_pool.reserve)
+        cnt += kernel_pool.free_cnt - kernel_pool.reserve;
+      lock_release (&kernel_pool.lock);
+    }
+  return cnt;
+}
+
+/* Returns the index of PAGE among the pages that may hold user
+   pages, which lies in the range [0, palloc_user_page_cnt ()).
+   PAGE must belong to the user pool, or be lent by the kernel
+   pool. */
+size_t
+palloc_user_page_no (void *page)
+{
+  ASSERT (page_from_pool (&user_pool, page)
+          || page_from_pool (&kernel_pool, page));
+  return pg_no (page) - pg_no (kernel_pool.base);
+}
+
+/* Returns true if PAGE was lent to the user pool by the kernel
+   pool. */
+bool
+palloc_page_lent (void *page)
+{
+  return page_from_pool (&kernel_pool, page)
+         && bitmap_test (kernel_pool.lent_map,
+                         pg_no (page) - pg_no (kernel_pool.base));
+}
+
+/* Returns true if the kernel pool ran short of its reserve with
+   pages lent to the user pool, which it wants back. */
+bool
+palloc_kernel_short (void)
+{
+  return kernel_pool.lent_cnt > 0
+         && kernel_pool.free_cnt < kernel_pool.reserve;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map, lent_map, zero_pages and orders
+     at its base.  Calculate the space needed for them
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (2 * bm_size
+                                  + page_cnt * (sizeof (size_t) + 1),
+                                  PGSIZE);
+  unsigned order;
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,8 +332,27 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->lent_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + bm_size,
+                                     bm_size);
+  p->lent_cnt = 0;
+  p->reserve = page_cnt / 4;
+  p->zero_pages = (size_t *) ((uint8_t *) base + 2 * bm_size);
+  p->zero_cnt = 0;
+  p->orders = (uint8_t *) (p->zero_pages + page_cnt);
+  memset (p->orders, NO_BLOCK, page_cnt);
+  for (order = 0; order < PALLOC_ORDERS; order++)
+    {
+      list_init (&p->free_lists[order]);
+      p->block_cnts[order] = 0;
+    }
+  p->page_cnt = page_cnt;
+  p->name = name;
   p->base = base + bm_pages * PGSIZE;
+
+  /* All of the pool starts out free. */
+  p->free_cnt = 0;
+  pages_free (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +362,244 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Obtains PAGE_CNT contiguous free pages of POOL, zeroed if
+   PAL_ZERO is set in FLAGS, or a null pointer if there are not
+   enough.  If LEND, the pages are lent to the other pool, as long
+   as POOL keeps its reserve free. */
+static void *
+pool_get (struct pool *pool, enum palloc_flags flags, size_t page_cnt,
+          bool lend) 
+{
+  void *pages;
+  size_t page_idx = BITMAP_ERROR;
+  bool zeroed = false;
+
+  lock_acquire (&pool->lock);
+  if (lend && pool->free_cnt < pool->reserve + page_cnt)
+    ;
+  else if ((flags & PAL_ZERO) && page_cnt == 1 && pool->zero_cnt > 0)
+    {
+      /* A page zeroed ahead of time saves the memset(). */
+      page_idx = pool->zero_pages[--pool->zero_cnt];
+      bitmap_mark (pool->used_map, page_idx);
+      pool->free_cnt--;
+      zeroed = true;
+    }
+  else
+    {
+      page_idx = pages_alloc (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR && pool->zero_cnt > 0)
+        {
+          /* Zeroed pages may be what keeps free blocks apart. */
+          zero_drain (pool);
+          page_idx = pages_alloc (pool, page_cnt);
+        }
+    }
+  if (page_idx != BITMAP_ERROR && lend)
+    {
+      bitmap_set_multiple (pool->lent_map, page_idx, page_cnt, true);
+      pool->lent_cnt += page_cnt;
+    }
+  if (page_idx != BITMAP_ERROR && (flags & PAL_ZERO))
+    {
+      if (zeroed)
+        zero_hit_cnt++;
+      else
+        zero_miss_cnt++;
+    }
+  lock_release (&pool->lock);
+
+  if (page_idx == BITMAP_ERROR)
+    return NULL;
+
+  pages = pool->base + PGSIZE * page_idx;
+  if ((flags & PAL_ZERO) && !zeroed)
+    memset (pages, 0, PGSIZE * page_cnt);
+  return pages;
+}
+
+/* Takes PAGE_CNT pages out of the free blocks of POOL, which
+   must be locked, and returns the index of the first, or
+   BITMAP_ERROR if there is no block that large.  The pages come
+   from the smallest block large enough, and what remains of the
+   block goes back to the free lists. */
+static size_t
+pages_alloc (struct pool *pool, size_t page_cnt) 
+{
+  unsigned order = 0;
+  size_t page_idx;
+
+  while (((size_t) 1 << order) < page_cnt)
+    order++;
+  if (order >= PALLOC_ORDERS)
+    return BITMAP_ERROR;
+
+  page_idx = block_alloc (pool, order);
+  if (page_idx == BITMAP_ERROR)
+    return BITMAP_ERROR;
+  pool->free_cnt -= (size_t) 1 << order;
+  if (page_cnt < ((size_t) 1 << order))
+    pages_free (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+
+  ASSERT (!bitmap_any (pool->used_map, page_idx, page_cnt));
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+  return page_idx;
+}
+
+/* Gives the PAGE_CNT pages from PAGE_IDX back to the free blocks
+   of POOL, which must be locked.  The pages are split into the
+   largest blocks their alignment allows, each of which then joins
+   its buddies. */
+static void
+pages_free (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  ASSERT (page_idx + page_cnt <= pool->page_cnt);
+
+  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  pool->free_cnt += page_cnt;
+  while (page_cnt > 0) 
+    {
+      unsigned order = 0;
+
+      while (order + 1 < PALLOC_ORDERS
+             && (page_idx & ((size_t) 1 << order)) == 0
+             && ((size_t) 2 << order) <= page_cnt)
+        order++;
+      block_free (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+      page_cnt -= (size_t) 1 << order;
+    }
+}
+
+/* Takes a free block of ORDER out of POOL, splitting a larger
+   block if there is none, and returns the index of its first
+   page, or BITMAP_ERROR if there is no block that large.  Does
+   not count the pages as used. */
+static size_t
+block_alloc (struct pool *pool, unsigned order) 
+{
+  unsigned o = order;
+  size_t page_idx;
+
+  while (o < PALLOC_ORDERS && list_empty (&pool->free_lists[o]))
+    o++;
+  if (o == PALLOC_ORDERS)
+    return BITMAP_ERROR;
+
+  page_idx = ((uint8_t *) list_front (&pool->free_lists[o]) - pool->base)
+             / PGSIZE;
+  block_remove (pool, page_idx);
+
+  /* Keep the lower half, give back the upper half. */
+  while (o > order) 
+    {
+      o--;
+      block_insert (pool, page_idx + ((size_t) 1 << o), o);
+    }
+  return page_idx;
+}
+
+/* Adds the block of ORDER at PAGE_IDX to the free lists of POOL,
+   joined with its buddy into a block of the next order for as
+   long as the buddy is free as a whole. */
+static void
+block_free (struct pool *pool, size_t page_idx, unsigned order) 
+{
+  while (order + 1 < PALLOC_ORDERS) 
+    {
+      size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+      if (buddy >= pool->page_cnt || pool->orders[buddy] != order)
+        break;
+      block_remove (pool, buddy);
+      page_idx &= ~((size_t) 1 << order);
+      order++;
+    }
+  block_insert (pool, page_idx, order);
+}
+
+/* Puts the block of ORDER at PAGE_IDX on its free list. */
+static void
+block_insert (struct pool *pool, size_t page_idx, unsigned order) 
+{
+  struct list_elem *e = (struct list_elem *) (pool->base
+                                              + PGSIZE * page_idx);
+
+  list_push_front (&pool->free_lists[order], e);
+  pool->orders[page_idx] = order;
+  pool->block_cnts[order]++;
+}
+
+/* Takes the free block at PAGE_IDX off its free list. */
+static void
+block_remove (struct pool *pool, size_t page_idx) 
+{
+  struct list_elem *e = (struct list_elem *) (pool->base
+                                              + PGSIZE * page_idx);
+  unsigned order = pool->orders[page_idx];
+
+  ASSERT (order < PALLOC_ORDERS);
+  list_remove (e);
+  pool->orders[page_idx] = NO_BLOCK;
+  pool->block_cnts[order]--;
+}
+
+/* Zeroes a free page of POOL, if POOL is not busy and no more
+   than half of its free pages are zeroed already, and keeps it
+   on the stack of zeroed pages.  Returns true if a page was
+   zeroed. */
+static bool
+zero_free_page (struct pool *pool) 
+{
+  size_t page_idx = BITMAP_ERROR;
+
+  if (!lock_try_acquire (&pool->lock))
+    return false;
+  if (pool->zero_cnt < pool->free_cnt / 2)
+    page_idx = block_alloc (pool, 0);
+  lock_release (&pool->lock);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+  /* The idle thread must not block.  Whoever holds the lock is
+     ready to run, so let it go on until it releases the lock. */
+  while (!lock_try_acquire (&pool->lock))
+    thread_yield ();
+  pool->zero_pages[pool->zero_cnt++] = page_idx;
+  zero_idle_cnt++;
+  lock_release (&pool->lock);
+  return true;
+}
+
+/* Gives the zeroed pages of POOL, which must be locked, back to
+   its free lists. */
+static void
+zero_drain (struct pool *pool) 
+{
+  while (pool->zero_cnt > 0)
+    block_free (pool, pool->zero_pages[--pool->zero_cnt], 0);
+}
+
+/* Prints the free pages of POOL and its free blocks by order, up
+   to the largest order that fits in POOL. */
+static void
+print_pool_stats (const struct pool *pool) 
+{
+  unsigned order;
+
+  printf ("Palloc: %s: %zu of %zu pages free, %zu zeroed, %zu lent, "
+          "free blocks by order:",
+          pool->name, pool->free_cnt, pool->page_cnt, pool->zero_cnt,
+          pool->lent_cnt);
+  for (order = 0; order < PALLOC_ORDERS
+                  && ((size_t) 1 << order) <= pool->page_cnt; order++)
+    printf (" %zu", pool->block_cnts[order]);
+  printf ("\n");
+}
@@ -0,0 +1,202 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* An object cache allocator.
+
+   Each cache keeps objects of one size in pages of their own,
+   called "slabs".  Unlike malloc(), sizes are not rounded up to
+   a power of 2, and objects sit next to each other, so more of
+   them fit in a page.
+
+   Objects are run through the cache's constructor when their
+   slab is created, and are expected back in that state, so
+   fields such as locks and lists are set up only once per
+   object rather than on every allocation.  Because of that, the
+   free list element of an object lives past its end, and not
+   inside it as for malloc() blocks.
+
+   A slab whose objects are all free goes back to the page
+   allocator, unless it holds the last free objects of its cache,
+   so a cache that keeps allocating and freeing a few objects
+   does not keep getting and freeing pages.  The slabs of a
+   type stable cache are never given back, so memory that once
+   held one of its objects keeps holding one, allocated or free.
+   Code that finds an object through a pointer that may have gone
+   stale can still take the object's lock, then check whether it
+   is the object it was after. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x5ab1ca4e
+
+/* Slab header, at the start of each slab page. */
+struct slab 
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    size_t used_cnt;            /* Number of allocated objects. */
+  };
+
+static size_t slot_size (const struct slab_cache *);
+static struct list_elem *obj_to_elem (const struct slab_cache *, void *);
+static void *elem_to_obj (const struct slab_cache *, struct list_elem *);
+static void *slab_obj (struct slab *, size_t idx);
+static bool slab_grow (struct slab_cache *);
+
+/* Initializes cache C for objects of SIZE bytes, named NAME,
+   constructed by CTOR if it is non-null. */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t size,
+                 slab_ctor_func *ctor) 
+{
+  ASSERT (size > 0);
+
+  c->name = name;
+  c->obj_size = ROUND_UP (size, sizeof (void *));
+  c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / slot_size (c);
+  ASSERT (c->objs_per_slab > 0);
+  c->ctor = ctor;
+  list_init (&c->free_list);
+  c->free_cnt = 0;
+  c->slab_cnt = 0;
+  c->type_stable = false;
+  lock_init (&c->lock);
+}
+
+/* Makes C type stable: its slabs stay with it even once all of
+   their objects are free. */
+void
+slab_cache_set_type_stable (struct slab_cache *c) 
+{
+  c->type_stable = true;
+}
+
+/* Obtains and returns a constructed object from C.
+   Returns a null pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *c) 
+{
+  void *obj;
+
+  lock_acquire (&c->lock);
+  if (list_empty (&c->free_list) && !slab_grow (c)) 
+    {
+      lock_release (&c->lock);
+      return NULL;
+    }
+
+  obj = elem_to_obj (c, list_pop_front (&c->free_list));
+  ((struct slab *) pg_round_down (obj))->used_cnt++;
+  c->free_cnt--;
+  lock_release (&c->lock);
+
+  return obj;
+}
+
+/* Gives OBJ, obtained from C and in its constructed state, back
+   to C.  A null OBJ is ignored. */
+void
+slab_free (struct slab_cache *c, void *obj) 
+{
+  struct slab *s;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+
+  lock_acquire (&c->lock);
+  ASSERT (s->used_cnt > 0);
+  s->used_cnt--;
+  c->free_cnt++;
+
+  /* Recently used objects are handed out first. */
+  list_push_front (&c->free_list, obj_to_elem (c, obj));
+
+  /* Give the slab back if it is empty, and other slabs have
+     enough free objects. */
+  if (s->used_cnt == 0 && !c->type_stable
+      && c->free_cnt >= 2 * c->objs_per_slab) 
+    {
+      size_t i;
+
+      for (i = 0; i < c->objs_per_slab; i++) 
+        list_remove (obj_to_elem (c, slab_obj (s, i)));
+      c->free_cnt -= c->objs_per_slab;
+      c->slab_cnt--;
+      s->magic = 0;
+      palloc_free_page (s);
+    }
+  lock_release (&c->lock);
+}
+
+/* Prints statistics about C. */
+void
+slab_print_stats (struct slab_cache *c) 
+{
+  lock_acquire (&c->lock);
+  printf ("Slab %s: %zu objects in use, %zu slabs of %zu %zu-byte objects\n",
+          c->name, c->slab_cnt * c->objs_per_slab - c->free_cnt,
+          c->slab_cnt, c->objs_per_slab, c->obj_size);
+  lock_release (&c->lock);
+}
+
+/* Returns the number of bytes an object takes in a slab. */
+static size_t
+slot_size (const struct slab_cache *c) 
+{
+  return c->obj_size + sizeof (struct list_elem);
+}
+
+/* Returns the free list element of OBJ in C. */
+static struct list_elem *
+obj_to_elem (const struct slab_cache *c, void *obj) 
+{
+  return (struct list_elem *) ((uint8_t *) obj + c->obj_size);
+}
+
+/* Returns the object of free list element E in C. */
+static void *
+elem_to_obj (const struct slab_cache *c, struct list_elem *e) 
+{
+  return (uint8_t *) e - c->obj_size;
+}
+
+/* Returns the IDX'th object in slab S. */
+static void *
+slab_obj (struct slab *s, size_t idx) 
+{
+  return (uint8_t *) (s + 1) + idx * slot_size (s->cache);
+}
+
+/* Adds a slab of constructed objects to C.
+   Returns false if memory is not available. */
+static bool
+slab_grow (struct slab_cache *c) 
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return false;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->used_cnt = 0;
+  for (i = 0; i < c->objs_per_slab; i++) 
+    {
+      void *obj = slab_obj (s, i);
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      list_push_back (&c->free_list, obj_to_elem (c, obj));
+    }
+  c->free_cnt += c->objs_per_slab;
+  c->slab_cnt++;
+  return true;
+}
@@ -0,0 +1,37 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Constructor of the objects of a cache. */
+typedef void slab_ctor_func (void *);
+
+/* Object cache.  Hands out objects of a single type, carved out
+   of pages of their own.  Objects are constructed once, when
+   their page is added to the cache, and must be given back in
+   their constructed state, e.g. with locks released and lists
+   empty, so a new object need not be initialized again. */
+struct slab_cache
+  {
+    const char *name;           /* For statistics. */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a page. */
+    slab_ctor_func *ctor;       /* Constructor, may be null. */
+    struct list free_list;      /* List of free objects. */
+    size_t free_cnt;            /* Number of free objects. */
+    size_t slab_cnt;            /* Number of pages. */
+    bool type_stable;           /* Never give slabs back? */
+    struct lock lock;           /* Lock. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      slab_ctor_func *);
+void slab_cache_set_type_stable (struct slab_cache *);
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (struct slab_cache *);
+
+#endif /* threads/slab.h */
@@ -29,6 +29,11 @@ static struct list ready_list;
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
+/* List of threads that died, whose pages are freed by
+   thread_reap () once it is safe to block on the pool lock,
+   which thread_schedule_tail() cannot do. */
+static struct list dying_list;
+
 /* Idle thread. */
 static struct thread *idle_thread;
 
@@ -69,6 +74,7 @@ static void init_thread (struct thread *, const char *name,
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
+static void thread_reap (void);
 static void init_info (struct thread *t, tid_t tid); 
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
@@ -94,6 +100,7 @@ thread_init (void)
   lock_init (&tid_lock);
   list_init (&ready_list);
   list_init (&all_list);
+  list_init (&dying_list);
   lock_init (&glb_lock_filesys);
   lock_init (&glb_lock_swapsys);
 
@@ -181,7 +188,8 @@ thread_create (const char *name, int priority,
 
   ASSERT (function != NULL);
 
-  /* Allocate thread. */
+  /* Allocate thread, after freeing those that died. */
+  thread_reap ();
   t = palloc_get_page (PAL_ZERO);
   if (t == NULL)
     return TID_ERROR;
@@ -299,6 +307,8 @@ thread_exit (void)
 {
   ASSERT (!intr_context ());
 
+  thread_reap ();
+
 #ifdef USERPROG
   process_exit ();
 #endif
@@ -411,6 +421,12 @@ idle (void *idle_started_ UNUSED)
 
   for (;;) 
     {
+      /* Zero free pages ahead of their use while no one else is
+         ready, a page at a time, so a thread that becomes ready
+         waits for one page at most. */
+      while (list_empty (&ready_list) && palloc_zero_idle ())
+        continue;
+
       /* Let someone else run. */
       intr_disable ();
       thread_block ();
@@ -491,6 +507,7 @@ init_thread (struct thread *t, const char *name,
   /* Initialize mmap file list */
   t->next_mapid = 0;
   list_init (&t->mmap_list);
+  list_init (&t->vma_list);
 
   /* Initialize children process list */
   list_init (&t->child_list);
@@ -586,15 +603,37 @@ thread_schedule_tail (struct thread *prev)
   process_activate ();
 #endif
 
-  /* If the thread we switched from is dying, destroy its struct
-     thread.  This must happen late so that thread_exit() doesn't
-     pull out the rug under itself.  (We don't free
-     initial_thread because its memory was not obtained via
+  /* If the thread we switched from is dying, queue its struct
+     thread to be destroyed.  This must happen late so that
+     thread_exit() doesn't pull out the rug under itself.  Freeing
+     it takes the pool lock, which may not be taken here with
+     interrupts off, so thread_reap() does that later.  (We don't
+     free initial_thread because its memory was not obtained via
      palloc().) */
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      list_push_back (&dying_list, &prev->elem);
+    }
+}
+
+/* Frees the pages of the threads that died, if interrupts are on
+   so that the pool lock may be waited for. */
+static void
+thread_reap (void)
+{
+  while (intr_get_level () == INTR_ON)
+    {
+      struct thread *t = NULL;
+
+      intr_disable ();
+      if (!list_empty (&dying_list))
+        t = list_entry (list_pop_front (&dying_list), struct thread, elem);
+      intr_enable ();
+
+      if (t == NULL)
+        break;
+      palloc_free_page (t);
     }
 }
 
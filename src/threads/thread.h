@@ -2,6 +2,7 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/synch.h"
@@ -110,6 +111,24 @@ struct thread
     struct list mmap_list;              /* List of mmaped files */
     int next_mapid;                     /* Next available mmaped file id */
 
+    /* File backed areas of the address space, see vm/vma.h */
+    struct list vma_list;               /* List of struct vma */
+
+    /* Supplemental page table, private to this process */
+    struct hash sup_pt;                 /* Page structures keyed by pte */
+    struct lock sup_pt_lock;            /* Protects sup_pt */
+
+    /* For read-ahead of file backed pages, see swap_in_around () */
+    void *ra_next;                      /* Page expected to fault next */
+    size_t ra_window;                   /* Pages to read ahead */
+
+    /* Resident set, see vm/frame.c */
+    size_t rss_cnt;                     /* Frames charged to the process */
+    size_t ws_cur;                      /* Frames found accessed in this
+                                           turn of the clock hand */
+    size_t ws_size;                     /* Working set estimate, frames
+                                           accessed in the last turn */
+
     /* For stack growth */
     void * user_esp;                    /* user esp */
     void * stack_bound; 	        /* Stack bound */
@@ -157,6 +176,7 @@ struct mmap_struct
     int mapid;                          /* mmaped file id */
     struct file* p_file;                /* file struct from file_reopen() */
     void* vaddr;                        /* begin of vaddr for mmaped file */
+    struct vma *vma;                    /* Area of the mapping */
     struct list_elem elem;
   };
 
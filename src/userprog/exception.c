@@ -10,6 +10,7 @@
 #include "threads/malloc.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/vma.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -135,6 +136,7 @@ page_fault (struct intr_frame *f)
   void *fault_addr;  /* Fault address. */
   bool success;
   struct page_struct *ps = NULL;
+  struct frame_struct *fs = NULL;
 
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -166,17 +168,13 @@ page_fault (struct intr_frame *f)
       kill (f);
     }
 
-  bool holding_filesys_lock;
-  holding_filesys_lock = false;
-  if (lock_held_by_current_thread (&glb_lock_filesys))
-  {
-    holding_filesys_lock = true;
-    lock_release (&glb_lock_filesys);
-  }
+  /* System calls pin user memory before taking the file system
+     lock, see sup_pt_pin (), so swapping in never has to wait for
+     a lock the faulting thread holds itself */
+  ASSERT (!lock_held_by_current_thread (&glb_lock_filesys));
 
-  /* The address should not be present */
-  if (!not_present) 
-    goto bad_page_fault;
+  bool read_around = false;
+  bool from_swap = false;
 
 //  printf ("tid = %ld, Fault_addr = %lx\n", t->tid, fault_addr);
 
@@ -217,47 +215,110 @@ page_fault (struct intr_frame *f)
       
       /* Now grow the stack */
       t->stack_bound = pg_round_down (fault_addr);
-      lock_acquire (&ps->fs->frame_lock);
+      fs = ps->fs;
+      lock_acquire (&fs->frame_lock);
       goto normal_page_fault;
     }
 
-  /* Get page directory entry */
-  uint32_t *pd = t->pagedir;
-  uint32_t *pde = pd + pd_no (fault_addr);
-  if (*pde == 0)
+  /* A page that is tracked but not present keeps its frame in its
+     pte, so such faults need not look up the supplemental page
+     table */
+  uint32_t *pte = sup_pt_pte_lookup (t->pagedir, fault_addr, false);
+  if (pte != NULL && not_present)
+    fs = sup_pt_pte_frame (pte);
+
+  if (fs == NULL)
     {
-      goto bad_page_fault;
+      /* Get supplementale page table entry, a page of a file backed
+         area gets one on its first fault */
+      ps = pte != NULL ? sup_pt_ps_lookup (pte) : NULL;
+      if (ps == NULL && not_present
+          && vma_track_page (pg_round_down (fault_addr)))
+        {
+          pte = sup_pt_pte_lookup (t->pagedir, fault_addr, false);
+          ps = sup_pt_ps_lookup (pte);
+        }
+
+      /* No entry in supplemental page table indicates a bad address */
+      if (ps == NULL) 
+        goto bad_page_fault;  
+      fs = sup_pt_lock_frame (ps);
     }
+  else
+    lock_acquire (&fs->frame_lock);
+  fs->flag |= FS_PINNED;
 
-  /* Get supplementale page table entry */
-  uint32_t *pt = pde_get_pt (*pde);
-  uint32_t *pte = pt + pt_no (fault_addr);
-  ps = sup_pt_ps_lookup (pte);
+  if (!not_present)
+    {
+      /* The merge scanner write protects a page for a moment while
+         comparing it, so the write may simply be done again */
+      if (write && (*pte & PTE_W) != 0)
+        {
+          fs->flag &= ~FS_PINNED;
+          lock_release (&fs->frame_lock);
+          goto done;
+        }
 
-  /* No entry in supplemental page table indicates a bad address */
-  if (ps == NULL) 
-    goto bad_page_fault;  
+      /* The only legal faults on a present page are writes to a
+         copy on write frame shared after fork (), and the first
+         write to the shared zero page, which gets a frame of its
+         own */
+      if (!write || (fs->flag & FS_READONLY) != 0
+          || ((fs->flag & FS_COW) == 0
+              && !sup_pt_is_zero_page (pte_get_page (*pte))))
+        {
+          fs->flag &= ~FS_PINNED;
+          lock_release (&fs->frame_lock);
+          goto bad_page_fault;
+        }
 
-  lock_acquire (&ps->fs->frame_lock);
-  ps->fs->flag |= FS_PINNED;
+      if ((fs->flag & FS_COW) != 0)
+        {
+          success = sup_pt_break_cow (ps);
+          ps->fs->flag &= ~FS_PINNED;
+          lock_release (&ps->fs->frame_lock);
+          if (!success)
+            goto bad_page_fault;
+          goto done;
+        }
+    }
+  else if ((fs->flag & POSBITS) == POS_MEM
+           || ((fs->flag & FS_ZERO) != 0 && !write))
+    {
+      /* Either the page was brought in by whoever held the frame
+         before us, or a read of a zero page, which is served by
+         the shared zero page until it is written */
+      if ((fs->flag & POSBITS) == POS_MEM)
+        sup_pt_set_swap_in (fs, fs->vaddr);
+      else
+        sup_pt_map_zero_page (fs, pte);
+      fs->flag &= ~FS_PINNED;
+      lock_release (&fs->frame_lock);
+      goto done;
+    }
+
+  /* Pages of a file may be followed by more of the same file,
+     and pages on swap by more evicted along with them */
+  from_swap = (fs->flag & POSBITS) == POS_SWAP;
+  read_around = ((fs->flag & POSBITS) == POS_DISK || from_swap)
+                && (fs->flag & FS_ZERO) == 0;
 
   /* Normal page_faults can come here */
   goto normal_page_fault;
 
 normal_page_fault:              /* Swap in the page */
 
-  success = swap_in (ps->fs);
+  success = swap_in (fs);
   if (!success)
     goto bad_page_fault;
 
-  ps->fs->flag &= ~FS_PINNED;
-  lock_release (&ps->fs->frame_lock);
+  fs->flag &= ~FS_PINNED;
+  lock_release (&fs->frame_lock);
+
+  if (read_around)
+    swap_in_around (pg_round_down (fault_addr), from_swap);
 
-  /* If previously holding the filesys_lock, reacquire the lock */
-  if (holding_filesys_lock)
-  {
-    lock_acquire (&glb_lock_filesys);
-  }
+done:
   return;
 
 bad_page_fault:                 /* Terminate the process */
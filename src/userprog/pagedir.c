@@ -6,10 +6,10 @@
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "vm/frame.h"
-#include "vm/swap.h"
 
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
+static inline void invalidate_tlb_entry (const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -24,8 +24,8 @@ pagedir_create (void)
   return pd;
 }
 
-/* Destroys page directory PD, freeing all the pages it
-   references. */
+/* Destroys page directory PD, freeing its page tables.  The user
+   pages it maps were released by sup_pt_destroy () already. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -39,21 +39,6 @@ pagedir_destroy (uint32_t *pd)
     if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
-        
-        /* Clean up supplemental page table along the way */
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
-            {
-              /* Free the frame when this is the last entry */
-              if (sup_pt_delete (pte))
-                palloc_free_page (pte_get_page (*pte));
-            }
-          else
-            {
-              /* Free the swap slot */
-              swap_free (pte);
-            }
         palloc_free_page (pt);
       }
   palloc_free_page (pd);
@@ -128,7 +113,7 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
       /* Map pte to kpage and update relevant bits */
       if (!sup_pt_set_memory_map (pte, kpage))
       {
-        *pte &= ~PTE_P;
+        *pte = 0;
         return false;
       }
       return true;
@@ -171,7 +156,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -199,7 +184,7 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
       else 
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -228,7 +213,7 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -262,21 +247,42 @@ active_pd (void)
   return ptov (pd);
 }
 
+/* Invalidates the TLB entry for PTE, the page table entry of
+   user virtual page UPAGE in some page directory, which the
+   caller need not know.  Nothing is done unless the active page
+   directory maps UPAGE through PTE: other page directories'
+   entries are not in the TLB. */
+void
+pagedir_invalidate_pte (const uint32_t *pte, const void *upage)
+{
+  uint32_t pde = active_pd ()[pd_no (upage)];
+
+  ASSERT (is_user_vaddr (upage));
+
+  if ((pde & PTE_P) != 0 && pde_get_pt (pde) + pt_no (upage) == pte)
+    invalidate_tlb_entry (upage);
+}
+
+/* Invalidates the TLB entry of the single page PAGE.
+   See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+static inline void
+invalidate_tlb_entry (const void *page)
+{
+  asm volatile ("invlpg (%0)" : : "r" (page) : "memory");
+}
+
 /* Seom page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
+   table.  When this happens, we have to "invalidate" the TLB
+   entry of the page that changed.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   This function invalidates the entry of UPAGE if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.) */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *upage) 
 {
   if (active_pd () == pd) 
-    {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
+    invalidate_tlb_entry (upage);
 }
@@ -22,8 +22,11 @@
 #include "threads/pte.h"
 #include "threads/malloc.h"
 #include "vm/frame.h"
+#include "vm/vma.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static bool fork_files (struct thread *parent);
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 static bool argument_passing (const char *cmd_line, void **esp);
 static bool push_4byte (char** p_stack, void* val, void** esp);
@@ -103,6 +106,119 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* Passed by a forking process to its child */
+struct fork_args
+  {
+    struct intr_frame *if_;             /* Parent's user context */
+    struct thread *parent;              /* Forking process */
+  };
+
+/* Creates a child process that is a copy of the current one,
+   resuming from the user context IF_ with fork () returning 0.
+   Memory is shared copy on write, open files are reopened at the
+   same positions.  Returns the child's thread id, or TID_ERROR if
+   it could not be created. */
+tid_t
+process_fork (struct intr_frame *if_)
+{
+  struct thread *t = thread_current ();
+  struct fork_args args;
+  tid_t tid;
+
+  args.if_ = if_;
+  args.parent = t;
+
+  /* ARGS lives on our stack, so wait for the child to be done
+     with it, and with our address space */
+  tid = thread_create (t->name, PRI_DEFAULT, start_fork, &args);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+  sema_down (&t->process_info->sema_load);
+
+  return t->process_info->child_load_success ? tid : TID_ERROR;
+}
+
+/* A thread function that copies the forking process and starts
+   it running. */
+static void
+start_fork (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *parent = args->parent;
+  struct thread *t = thread_current ();
+  struct intr_frame if_;
+  bool success = false;
+
+  memcpy (&if_, args->if_, sizeof if_);
+  if_.eax = 0;
+
+  /* Duplicate the address space */
+  t->pagedir = pagedir_create ();
+  if (t->pagedir != NULL)
+    {
+      process_activate ();
+      t->stack_bound = parent->stack_bound;
+      success = sup_pt_create () && vma_fork (parent)
+                && sup_pt_fork (parent) && fork_files (parent);
+    }
+
+  /* Notify parent process whether the copy is successful */
+  parent->process_info->child_load_success = success;
+  sema_up (&parent->process_info->sema_load);
+
+  if (!success) 
+    { 
+      t->process_info->exit_status = -1;
+      thread_exit ();
+    }
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Reopen the executable and the open files of PARENT in the
+   current process, under the same file descriptors */
+static bool
+fork_files (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  bool success = true;
+  int fd;
+
+  lock_acquire (&glb_lock_filesys);
+  if (parent->executable != NULL)
+    {
+      t->executable = file_reopen (parent->executable);
+      if (t->executable == NULL)
+        success = false;
+      else
+        file_deny_write (t->executable);
+    }
+
+  for (fd = 2; success && fd < 128; fd++)
+    if (parent->array_files[fd] != NULL)
+      {
+        struct file_info *f_info = malloc (sizeof (struct file_info));
+        if (f_info == NULL)
+          {
+            success = false;
+            break;
+          }
+        f_info->pos = parent->array_files[fd]->pos;
+        f_info->p_file = file_reopen (parent->array_files[fd]->p_file);
+        if (f_info->p_file == NULL)
+          {
+            free (f_info);
+            success = false;
+            break;
+          }
+        t->array_files[fd] = f_info;
+      }
+  lock_release (&glb_lock_filesys);
+
+  return success;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -156,6 +272,7 @@ process_exit (void)
       _munmap (i);
     }
   }
+  vma_destroy ();
 
   /* Close all files and free their resources */
   int fd;
@@ -185,9 +302,12 @@ process_exit (void)
          that's been freed (and cleared). */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
-      pagedir_destroy (pd);
     }
 
+  /* Release the pages of the process, then its page tables */
+  sup_pt_destroy ();
+  pagedir_destroy (pd);
+
   /* If not kernel thread, print the exit message, update process metadata 
      and free resources */
   if (!(cur->is_kernel))
@@ -303,6 +423,10 @@ load (const char *cmd_line, void (**eip) (void), void **esp)
     goto done;
   process_activate ();
 
+  /* Allocate this process's supplemental page table. */
+  if (!sup_pt_create ())
+    goto done;
+
   /* Separate program file name from following arguments. */
   char prog_file_name[16];
   get_prog_file_name (cmd_line, prog_file_name);
@@ -398,8 +522,11 @@ load (const char *cmd_line, void (**eip) (void), void **esp)
   /* Start address. */
   *eip = (void (*) (void)) ehdr.e_entry;
 
-  /* Do argument passing. */
-  if (!argument_passing (cmd_line, esp))
+  /* Do argument passing, then let the stack page setup_stack ()
+     pinned be evicted */
+  bool passed = argument_passing (cmd_line, esp);
+  sup_pt_clear_pinned (PHYS_BASE - PGSIZE);
+  if (!passed)
     goto done;
   
   t->executable = file;
@@ -480,49 +607,17 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file_seek (file, ofs);
-  while (read_bytes > 0 || zero_bytes > 0) 
-    {
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Lazy loading, instead of allocating frame right away,
-         just mark the page as if the page is swapped out */
-      uint32_t flag = POS_DISK | TYPE_Executable;
-      if (page_read_bytes == 0)
-          flag |= FS_ZERO;
-
-      if (!writable)
-          flag |= FS_READONLY;
-
-      block_sector_t sector_idx =
-        byte_to_sector (file_get_inode (file), ofs);
-
-     /* For sharing: traverse frame table, find an executable frame
-         containing this sector block data */
-      struct frame_struct* fs_prev = frame_lookup_exec (sector_idx, flag);
-      if (fs_prev != NULL)	/* Found the same exec page */
-        {
-          if (!mark_shared_page (upage, fs_prev))
-            return false;
-        }
-      else			/* Not found, mark a new page */ 
-        {
-          if (!mark_page (upage, NULL, page_read_bytes, flag, sector_idx))
-            return false;
-        }
-
+  /* Lazy loading, instead of marking each page as if it is
+     swapped out, record the segment as an area whose pages are
+     tracked once they fault, see vma_track_page () */
+  uint32_t flag = TYPE_Executable;
+  if (!writable)
+    flag |= FS_READONLY;
 
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      ofs += page_read_bytes;
-      upage += PGSIZE;
-    }
-  return true;
+  if (vma_overlaps (upage, read_bytes + zero_bytes))
+    return false;
+  return vma_add (upage, read_bytes + zero_bytes, file, ofs,
+                  read_bytes, flag) != NULL;
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -539,7 +634,9 @@ setup_stack (void **esp)
       void* addr = (void*)PHYS_BASE - PGSIZE;
 
       uint32_t* pd = thread_current ()->pagedir;
-      uint32_t flag = POS_MEM | TYPE_Stack;
+      /* Pinned from the start, as arguments are pushed into it
+         while the file system lock is held, see load () */
+      uint32_t flag = POS_MEM | TYPE_Stack | FS_PINNED;
       mark_page (addr, kpage, PGSIZE, flag, SECTOR_ERROR);
       success = install_page (addr, kpage, true);
       if (success)
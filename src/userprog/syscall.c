@@ -17,6 +17,8 @@
 #include "userprog/process.h"
 #include "userprog/pagedir.h"
 #include "vm/frame.h"
+#include "vm/vma.h"
+#include "vm/swap.h"
 
 static void syscall_handler (struct intr_frame *);
 
@@ -34,6 +36,9 @@ static int _write (int fd, const void *buffer, unsigned size);
 static void _seek (int fd, unsigned position);
 static unsigned _tell (int fd);
 static void _close (int fd);
+static pid_t _fork (struct intr_frame *f);
+static bool _msync (mapid_t mapping);
+static bool _madvise (void *addr, size_t length, int advice);
 /*** static methods providing utility functions to above methods */
 
 /* determine a valid virtual address given from user */
@@ -53,9 +58,32 @@ static int add_file (struct thread* t, struct file_info* f_info);
 /* Kill a process and exit with status -1 */
 static void kill_process (void);
 
+/* Copy a user string to the kernel heap */
+static char *copy_in_string (const char *str);
+
 /* allocate a new mmap file id */
 static mapid_t allocate_mapid (void);
 
+/* Find the mapping record of a mmap file id */
+static struct mmap_struct *find_mmap (mapid_t mapping);
+
+/* Write dirty pages of a mapping back to its file */
+static void mmap_writeback (struct mmap_struct *ms);
+static void mmap_write_run (struct mmap_struct *ms, off_t ofs,
+                            struct frame_struct **run, size_t run_cnt);
+
+/* Drop pages of the current process for MADV_DONTNEED */
+static void madvise_dontneed (void *start, void *end);
+
+/* Stop tracking a user page, releasing what it held */
+static void release_page (uint32_t *pte, void *upage);
+
+/* Most pages written back by a single transfer */
+#define WRITEBACK_RUN_MAX 16
+
+/* Most bytes of a user buffer pinned at a time by read and write */
+#define PIN_CHUNK_MAX (16 * PGSIZE)
+
 
 void
 syscall_init (void) 
@@ -158,6 +186,22 @@ syscall_handler (struct intr_frame *f)
         _munmap ((mapid_t)arg1);
         break;
 
+      case SYS_FORK:
+        f->eax = (uint32_t)_fork (f);
+        break;
+
+      case SYS_MSYNC:
+        arg1 = read_stack (f, 4);
+        f->eax = (uint32_t)_msync ((mapid_t)arg1);
+        break;
+
+      case SYS_MADVISE:
+        arg1 = read_stack (f, 4);
+        arg2 = read_stack (f, 8);
+        arg3 = read_stack (f, 12);
+        f->eax = (uint32_t)_madvise ((void*)arg1, (size_t)arg2, (int)arg3);
+        break;
+
       default:
         kill_process ();    
         break;
@@ -206,6 +250,17 @@ _exec (const char *cmd_line)
       return -1;
 }
 
+static pid_t
+_fork (struct intr_frame *f)
+{
+  /* The child resumes from F, returning 0 */
+  pid_t pid = (pid_t) process_fork (f);
+
+  if (pid == TID_ERROR)
+    return -1;
+  return pid;
+}
+
 static int
 _wait (pid_t pid)
 {
@@ -221,12 +276,16 @@ _create (const char *file, unsigned initial_size)
       kill_process();
     }
 
+  char *name = copy_in_string (file);
+  if (name == NULL)
+    return false;
 
   /* protected filesys operation: create file */
   lock_acquire (&glb_lock_filesys);
-  bool success = filesys_create (file, initial_size);
+  bool success = filesys_create (name, initial_size);
   lock_release (&glb_lock_filesys);
 
+  free (name);
   return success;
 }
 
@@ -239,11 +298,16 @@ _remove (const char *file)
       kill_process();
     }
 
+  char *name = copy_in_string (file);
+  if (name == NULL)
+    return false;
+
   /* protected filesys operation: remove file */
   lock_acquire (&glb_lock_filesys);
-  bool success = filesys_remove (file);
+  bool success = filesys_remove (name);
   lock_release (&glb_lock_filesys);
 
+  free (name);
   return success;
 }
 
@@ -256,10 +320,15 @@ _open (const char *file)
       kill_process();
     }
 
+  char *name = copy_in_string (file);
+  if (name == NULL)
+    return -1;
+
   /* protected filesys operation: open file */
   lock_acquire (&glb_lock_filesys);
-  struct file* f_struct = filesys_open (file);
+  struct file* f_struct = filesys_open (name);
   lock_release (&glb_lock_filesys);
+  free (name);
 
   /* If open fails, return -1 */
   if (f_struct == NULL)
@@ -331,16 +400,31 @@ _read (int fd, void *buffer, unsigned size)
       struct file* pf = t->array_files[fd]->p_file;
       unsigned file_offset = t->array_files[fd]->pos;
 
-      /* protected filesys operation:
-         read and record length of read */
-      lock_acquire (&glb_lock_filesys);
-
-      result = file_read_at (pf, buffer, size, file_offset);
+      /* Read a chunk at a time into pinned user pages, so the
+         file system never faults on them */
+      while ((unsigned) result < size)
+        {
+          void *chunk = buffer + result;
+          unsigned chunk_size = size - result;
+          if (chunk_size > PIN_CHUNK_MAX)
+            chunk_size = PIN_CHUNK_MAX;
+
+          /* protected filesys operation:
+             read and record length of read */
+          sup_pt_pin (chunk, chunk_size, true);
+          lock_acquire (&glb_lock_filesys);
+          off_t cnt = file_read_at (pf, chunk, chunk_size,
+                                    file_offset + result);
+          lock_release (&glb_lock_filesys);
+          sup_pt_unpin (chunk, chunk_size);
+
+          result += cnt;
+          if ((unsigned) cnt < chunk_size)
+            break;
+        }
 
       /* increment position within file for current thread */
       t->array_files[fd]->pos += result;
-
-      lock_release (&glb_lock_filesys);
     }
   return result;
 }
@@ -370,16 +454,31 @@ _write (int fd, const void *buffer, unsigned size)
       struct file* pf = t->array_files[fd]->p_file;
       unsigned file_offset = t->array_files[fd]->pos;
 
-      /* Protect filesys operation:
-         write and record length of read */
-      lock_acquire (&glb_lock_filesys);
-
-      result = file_write_at (pf, buffer, size, file_offset);
+      /* Write a chunk at a time from pinned user pages, so the
+         file system never faults on them */
+      while ((unsigned) result < size)
+        {
+          const void *chunk = buffer + result;
+          unsigned chunk_size = size - result;
+          if (chunk_size > PIN_CHUNK_MAX)
+            chunk_size = PIN_CHUNK_MAX;
+
+          /* Protect filesys operation:
+             write and record length of write */
+          sup_pt_pin (chunk, chunk_size, false);
+          lock_acquire (&glb_lock_filesys);
+          off_t cnt = file_write_at (pf, chunk, chunk_size,
+                                     file_offset + result);
+          lock_release (&glb_lock_filesys);
+          sup_pt_unpin (chunk, chunk_size);
+
+          result += cnt;
+          if ((unsigned) cnt < chunk_size)
+            break;
+        }
 
       /* Increment position within file for current thread */
       t->array_files[fd]->pos += result;
-
-      lock_release (&glb_lock_filesys);
     }
 
   return result;
@@ -473,6 +572,8 @@ _mmap (int fd, void *addr)
             }
         }
     }
+  if (vma_overlaps (addr, f_size))
+    return MAP_FAILED;
   
   /* Allocate mapid */
   mapid_t mapid = allocate_mapid ();
@@ -491,10 +592,16 @@ _mmap (int fd, void *addr)
 
   struct file* new_file_ref = file_reopen (t->array_files[fd]->p_file);
 
+  /* Record the mapped area, its pages are tracked once they fault */
+  ms->vma = NULL;
+  if (new_file_ref != NULL)
+    ms->vma = vma_add (addr, f_size, new_file_ref, 0, f_size, TYPE_MMFile);
+
   lock_release (&glb_lock_filesys);
-  if (new_file_ref == NULL)
+  if (ms->vma == NULL)
     {
       /* Fail operation */
+      file_close (new_file_ref);
       free (ms);
       return MAP_FAILED;
     }
@@ -503,29 +610,6 @@ _mmap (int fd, void *addr)
   /* Record in mmap_list */
   list_push_back (&t->mmap_list, &ms->elem);
 
-  /* Begin mapping, creating sup_pt entries */
-  uint32_t read_bytes = f_size;
-  uint32_t zero_bytes = ROUND_UP (read_bytes, PGSIZE) - read_bytes;
-  void* upage = addr;
-  block_sector_t sector_idx = byte_to_sector (file_get_inode (ms->p_file), 0);
-  while (read_bytes > 0 || zero_bytes > 0)
-    {
-      /* Calculate how to fill this page */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      /* Add sup_pt entry */
-      uint32_t flag =
-        (page_read_bytes > 0 ? 0 : FS_ZERO) | POS_DISK | TYPE_MMFile;
-      mark_page (upage, NULL, page_read_bytes, flag, sector_idx);
-
-      /* Advance */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      upage += PGSIZE;
-      sector_idx += PGSIZE / BLOCK_SECTOR_SIZE;
-    }
-
   return mapid;
 }
 
@@ -533,62 +617,79 @@ void
 _munmap (mapid_t mapping)
 {
   struct thread* t = thread_current ();
-  struct list_elem* e = NULL;
-  struct list_elem* next_elem = NULL;
-  uint32_t f_size = 0;
+  struct mmap_struct* ms = find_mmap (mapping);
+  if (ms == NULL)
+    return;
 
-  /* Traverse list to find the mapping record */
-  for (e = list_begin (&t->mmap_list); e != list_end (&t->mmap_list);
-       e = next_elem)
+  /* Write back dirty pages, then release all pages */
+  mmap_writeback (ms);
+  void* upage;
+  for (upage = ms->vaddr; upage < ms->vma->end; upage += PGSIZE)
     {
-      struct mmap_struct* ms = list_entry (e, struct mmap_struct, elem);
-      if (ms->mapid == mapping)
-        {
-          /* Release pages, write back to disk in the process */
-          f_size = file_length (ms->p_file);
-          uint32_t write_bytes = f_size;
-          void* upage = ms->vaddr;
-          while (write_bytes > 0)
-            {
-              /* Calculate how to fill this page */
-              size_t page_write_bytes =
-                write_bytes < PGSIZE ? write_bytes : PGSIZE;
-
-              /* Write back to disk if page is dirty */
-              uint32_t* pte = sup_pt_pte_lookup (t->pagedir, upage, false);
-              struct page_struct* ps = sup_pt_ps_lookup (pte);
-              if (sup_pt_fs_is_dirty (ps->fs))
-                {
-                  file_write_at (ms->p_file, upage, write_bytes,
-                                 upage - ms->vaddr);
-                }
-
-              /* Delete pte and release frame */
-              uint32_t tmp_pte_content = *pte;
-              if (sup_pt_delete (pte))
-                {
-                  if ((tmp_pte_content & PTE_P) != 0)
-                    palloc_free_page (pte_get_page (tmp_pte_content));
-                }
-
-              /* Advance  */
-              write_bytes -= page_write_bytes;
-              upage += PGSIZE;
-            }
-
-          /* Remove this mapping record */
-          file_close (ms->p_file);
-          list_remove (e);
-          free (ms);
-          break;
-        }
-      else
-        {
-          next_elem = list_next (e);
-        }
+      /* Pages never touched were never tracked */
+      uint32_t* pte = sup_pt_pte_lookup (t->pagedir, upage, false);
+      if (pte != NULL)
+        release_page (pte, upage);
     }
+
+  /* Remove this mapping record */
+  vma_remove (ms->vma);
+  file_close (ms->p_file);
+  list_remove (&ms->elem);
+  free (ms);
 }
 
+/* Write the dirty pages of a mapping back to its file, keeping
+   the mapping.  Return false if there is no such mapping */
+static bool
+_msync (mapid_t mapping)
+{
+  struct mmap_struct* ms = find_mmap (mapping);
+  if (ms == NULL)
+    return false;
+
+  mmap_writeback (ms);
+  return true;
+}
+
+/* Advise about the use of LENGTH bytes from user page ADDR on.
+   MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL set the access
+   pattern of the areas in the range, used for read-ahead and
+   reclaim, MADV_WILLNEED brings the pages of the range in and
+   MADV_DONTNEED drops them.  Return false if the range or the
+   advice is invalid */
+static bool
+_madvise (void *addr, size_t length, int advice)
+{
+  void *end, *upage;
+
+  if (pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+      || length > (size_t) (PHYS_BASE - addr))
+    return false;
+  end = addr + ROUND_UP (length, PGSIZE);
+
+  switch (advice)
+    {
+      case MADV_NORMAL:
+      case MADV_RANDOM:
+      case MADV_SEQUENTIAL:
+        vma_advise (addr, length, advice);
+        return true;
+
+      case MADV_WILLNEED:
+        for (upage = addr; upage < end; upage += PGSIZE)
+          if (!swap_prefetch (upage))
+            break;
+        return true;
+
+      case MADV_DONTNEED:
+        madvise_dontneed (addr, end);
+        return true;
+
+      default:
+        return false;
+    }
+}
 
 /* Utility functions */
 
@@ -609,6 +710,20 @@ kill_process ()
   _exit (-1);
 }
 
+/* Copy STR, a user string whose address was checked, to the
+   kernel heap, so the file system never reads user memory.
+   Return NULL if out of memory */
+static char *
+copy_in_string (const char *str)
+{
+  size_t size = strlen (str) + 1;
+  char *copy = malloc (size);
+
+  if (copy != NULL)
+    memcpy (copy, str, size);
+  return copy;
+}
+
 /* Add a file to the open file arrays for a process */
 static int
 add_file (struct thread* t, struct file_info* f_info)
@@ -661,3 +776,152 @@ allocate_mapid (void)
   return result;
 }
 
+/* Find the mapping record of MAPPING in the current process */
+static struct mmap_struct *
+find_mmap (mapid_t mapping)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->mmap_list); e != list_end (&t->mmap_list);
+       e = list_next (e))
+    {
+      struct mmap_struct *ms = list_entry (e, struct mmap_struct, elem);
+      if (ms->mapid == mapping)
+        return ms;
+    }
+  return NULL;
+}
+
+/* Drop the pages from START to END of the current process.
+   Dirty pages of mappings are written back first, other contents
+   are lost: pages of an area are read from its file again on their
+   next fault, and stack pages come back zeroed */
+static void
+madvise_dontneed (void *start, void *end)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+  void *upage;
+
+  for (e = list_begin (&t->mmap_list); e != list_end (&t->mmap_list);
+       e = list_next (e))
+    {
+      struct mmap_struct *ms = list_entry (e, struct mmap_struct, elem);
+      if (ms->vaddr < end && start < ms->vma->end)
+        mmap_writeback (ms);
+    }
+
+  for (upage = start; upage < end; upage += PGSIZE)
+    {
+      uint32_t *pte = sup_pt_pte_lookup (t->pagedir, upage, false);
+      if (pte == NULL || sup_pt_ps_lookup (pte) == NULL)
+        continue;
+      release_page (pte, upage);
+
+      /* Stack pages are in no area, track them again as zero pages */
+      if (vma_find (upage) == NULL
+          && sup_pt_add (t->pagedir, upage, NULL, PGSIZE,
+                         POS_SWAP | TYPE_Stack | FS_ZERO, 0) == NULL)
+        kill_process ();
+    }
+}
+
+/* Stop tracking UPAGE of the current process, whose pte is PTE.
+   Its frame and swap slot are released unless still shared */
+static void
+release_page (uint32_t *pte, void *upage)
+{
+  uint32_t tmp_pte_content = *pte;
+
+  swap_free (pte);
+  if (sup_pt_delete (pte))
+    {
+      if ((tmp_pte_content & PTE_P) != 0
+          && !sup_pt_is_zero_page (pte_get_page (tmp_pte_content)))
+        palloc_free_page (pte_get_page (tmp_pte_content));
+    }
+  if ((tmp_pte_content & PTE_P) != 0)
+    {
+      *pte = 0;
+      pagedir_invalidate_pte (pte, upage);
+    }
+}
+
+/* Write the dirty pages of MS back to its file.  Only pages in
+   memory can be dirty, evicted ones were written back by
+   swap_out ().  Runs of adjacent dirty pages are written by one
+   transfer, straight from the user pages, whose frames stay
+   locked meanwhile */
+static void
+mmap_writeback (struct mmap_struct *ms)
+{
+  struct thread *t = thread_current ();
+  struct frame_struct *run[WRITEBACK_RUN_MAX];
+  size_t run_cnt = 0;
+  off_t run_ofs = 0;
+  off_t f_size = file_length (ms->p_file);
+  off_t ofs;
+
+  for (ofs = 0; ofs < f_size; ofs += PGSIZE)
+    {
+      uint32_t *pte = sup_pt_pte_lookup (t->pagedir, ms->vaddr + ofs, false);
+      struct page_struct *ps = pte != NULL ? sup_pt_ps_lookup (pte) : NULL;
+      bool dirty = false;
+
+      if (ps != NULL)
+        {
+          lock_acquire (&ps->fs->frame_lock);
+          dirty = (ps->fs->flag & POSBITS) == POS_MEM
+                  && (*pte & PTE_P) != 0
+                  && sup_pt_fs_is_dirty (ps->fs);
+          if (!dirty)
+            lock_release (&ps->fs->frame_lock);
+        }
+
+      if (!dirty)
+        {
+          mmap_write_run (ms, run_ofs, run, run_cnt);
+          run_cnt = 0;
+          continue;
+        }
+
+      /* Clean before writing, so writes from now on dirty it again */
+      sup_pt_fs_clear_dirty (ps->fs);
+      if (run_cnt == 0)
+        run_ofs = ofs;
+      run[run_cnt++] = ps->fs;
+      if (run_cnt == WRITEBACK_RUN_MAX)
+        {
+          mmap_write_run (ms, run_ofs, run, run_cnt);
+          run_cnt = 0;
+        }
+    }
+  mmap_write_run (ms, run_ofs, run, run_cnt);
+}
+
+/* Write RUN_CNT pages of MS from file offset OFS, whose locked
+   frames are in RUN, in one transfer and unlock them */
+static void
+mmap_write_run (struct mmap_struct *ms, off_t ofs,
+                struct frame_struct **run, size_t run_cnt)
+{
+  bool holding_filesys_lock = lock_held_by_current_thread (&glb_lock_filesys);
+  off_t size = run_cnt * PGSIZE;
+  off_t f_size = file_length (ms->p_file);
+  size_t i;
+
+  if (run_cnt == 0)
+    return;
+  if (ofs + size > f_size)
+    size = f_size - ofs;
+
+  if (!holding_filesys_lock)
+    lock_acquire (&glb_lock_filesys);
+  file_write_at (ms->p_file, ms->vaddr + ofs, size, ofs);
+  if (!holding_filesys_lock)
+    lock_release (&glb_lock_filesys);
+
+  for (i = 0; i < run_cnt; i++)
+    lock_release (&run[i]->frame_lock);
+}
@@ -6,25 +6,111 @@
 #include "threads/thread.h"
 #include "threads/pte.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
+#include "pageout.h"
+#include <string.h>
 
 #include <stdio.h>
 
-/* Supplemental Page Table is global. */
-struct hash sup_pt;
-struct lock sup_pt_lock;
-
-/* Frame Table */
-struct list frame_list;
-struct lock frame_list_lock;
+/* Frame Table, one slot per page of the user pool.
+   A slot holds the frame_struct currently resident in that page,
+   or NULL, so only frames in memory are ever visited */
+static struct frame_struct **frame_table;
+static size_t frame_cnt;
+static struct lock frame_table_lock;
+
+/* "Hand" in clock algorithm for frame eviction, index into frame_table */
+static size_t evict_hand;
+
+/* Frames in pages lent by the kernel pool are evicted when the
+   kernel pool wants them back, see sup_pt_evict_lent ().  The
+   frame table covers both pools for that reason */
+static size_t lent_hand;
+static long long lent_evict_cnt;       /* # of lent pages given back */
+
+/* Index of shareable executable frames, keyed by sector #,
+   whether or not they are resident.
+   Lock order: frame_lock, then exec_index_lock */
+static struct hash exec_index;
+static struct lock exec_index_lock;
+
+/* Number of frames evicted so far */
+static long long evict_cnt;
+
+/* Exec page cache.  A clean executable frame whose last pte goes
+   away stays in memory, indexed as before, so the next process
+   running the same program maps it without I/O.  Cached frames
+   are out of the frame table, oldest first in exec_cache, and
+   the first to be reclaimed when memory runs short.
+   Protected by exec_index_lock */
+static struct list exec_cache;
+static size_t exec_cache_cnt;
+static long long exec_cache_hit_cnt;
+static long long exec_cache_reclaim_cnt;
+
+/* Frames and swap slots left behind by the pages of an exiting
+   process, released a batch at a time, see sup_pt_destroy () */
+#define RELEASE_BATCH 32
+struct release_batch
+  {
+    struct frame_struct *frames[RELEASE_BATCH];
+    size_t fs_cnt;
+    block_sector_t slots[RELEASE_BATCH];
+    size_t slot_cnt;
+  };
+
+/* Resident set accounting.  A frame in memory is charged to the
+   process that brought it in, for as long as that process maps
+   it, see frame_charge ().  Every turn of the clock hand, the
+   frames found accessed make up the working set estimate of their
+   process.  Processes over their soft limit lose their frames
+   first, and reclaim from themselves once memory runs short */
+static size_t rss_limit;
+static long long self_evict_cnt;       /* # of frames reclaimed by
+                                          their own process */
+
+/* A page of zeros, mapped read only for reads of FS_ZERO pages
+   until they are written.  It comes from the kernel pool, so it
+   never enters the frame table */
+static uint8_t *zero_page;
+static long long zero_map_cnt;
+
+/* Merging of identical anonymous pages, see frame_merge_scan ().
+   merge_index maps the hash of each page's contents to the frame
+   table slot of a page seen with it during the current turn of
+   merge_hand.  Entries are only hints, checked against the frame
+   in the slot when used.  Only the merge scanner uses them */
+struct merge_node
+  {
+    struct hash_elem elem;
+    unsigned sum;               /* Hash of the contents */
+    size_t idx;                 /* Slot in frame_table */
+  };
+static struct hash merge_index;
+static size_t merge_hand;
+static long long merge_scan_cnt;        /* # of pages scanned */
+static long long merge_cnt;             /* # of pages merged */
+static long long unmerge_cnt;           /* # of merged pages written */
+
+/* Object caches for the per page metadata.  Frame structures
+   come out of their cache with frame_lock and an empty reverse
+   map set up, and go back with the lock released and the map
+   empty again.  Their cache is type stable, see
+   sup_pt_lock_frame () */
+static struct slab_cache page_struct_cache;
+static struct slab_cache frame_struct_cache;
 
-/* Lock for frame eviction */
-struct lock evict_lock;
+static void
+frame_struct_ctor (void *);
+static void
+frame_struct_free (struct frame_struct *);
 
-/* "Hand" in clock algorithm for frame eviction */
-struct frame_struct* evict_pointer;
+static inline uint32_t
+pte_create_frame (struct frame_struct *);
 
 /* Hash function used to organize supplemental page table as a hash table */
 static unsigned
@@ -38,16 +124,167 @@ sup_pt_fs_scan_and_reset_access (struct frame_struct *);
 static void
 sup_pt_fs_set_pte_list (struct frame_struct *, uint8_t *, bool);
 
-/* Initialize supplemental page table and frame table */
+static bool
+sup_pt_unlink (struct page_struct *, struct release_batch *);
+static void
+release_batch_add (struct release_batch *, struct frame_struct *);
+static void
+release_batch_flush (struct release_batch *);
+static void
+sup_pt_destroy_func (struct hash_elem *, void *);
+static bool
+frame_table_set (void *, struct frame_struct *, struct frame_struct *);
+static uint8_t *
+frame_evict (struct thread *);
+static bool
+frame_exec_cache_put (struct frame_struct *);
+static uint8_t *
+frame_exec_cache_reclaim (bool);
+static void
+frame_exec_cache_free (struct frame_struct *);
+static void
+frame_charge (struct frame_struct *, struct thread *);
+static void
+frame_uncharge (struct frame_struct *);
+static bool
+frame_over_limit (const struct thread *);
+static void
+frame_ws_roll (struct thread *, void *aux UNUSED);
+static void
+sup_pt_touch (const void *, bool);
+static bool
+sup_pt_fork_page (struct page_struct *);
+static struct pte_shared *
+sup_pt_fs_find_pte (struct frame_struct *, uint32_t *);
+static bool
+frame_rmap_add (struct frame_struct *, uint32_t *, void *);
+static bool
+frame_rmap_remove (struct frame_struct *, uint32_t *);
+static bool
+frame_is_shareable (uint32_t);
+static unsigned
+exec_index_hash_func (const struct hash_elem *, void *aux UNUSED);
+static bool
+exec_index_less_func (const struct hash_elem *, const struct hash_elem *,
+                      void *aux UNUSED);
+static bool
+frame_is_mergeable (struct frame_struct *);
+static bool
+frame_merge (struct frame_struct *, size_t, struct merge_node *);
+static bool
+frame_merge_into (struct frame_struct *, struct frame_struct *);
+static void
+frame_merge_protect (struct frame_struct *, bool);
+static unsigned
+merge_index_hash_func (const struct hash_elem *, void *aux UNUSED);
+static bool
+merge_index_less_func (const struct hash_elem *, const struct hash_elem *,
+                       void *aux UNUSED);
+static void
+merge_node_free (struct hash_elem *, void *aux UNUSED);
+
+/* Initialize frame table */
 void 
 sup_pt_init (void)
 {
-  hash_init (&sup_pt, sup_pt_hash_func, sup_pt_less_func, NULL);
-  list_init (&frame_list);
-  lock_init (&sup_pt_lock);
-  lock_init (&frame_list_lock);
-  lock_init (&evict_lock);
-  evict_pointer = NULL;
+  frame_cnt = palloc_user_page_cnt ();
+  frame_table = calloc (frame_cnt, sizeof *frame_table);
+  if (frame_table == NULL)
+    PANIC ("Failed to allocate frame table");
+  lock_init (&frame_table_lock);
+  hash_init (&exec_index, exec_index_hash_func, exec_index_less_func, NULL);
+  lock_init (&exec_index_lock);
+  list_init (&exec_cache);
+  hash_init (&merge_index, merge_index_hash_func, merge_index_less_func,
+             NULL);
+  merge_hand = 0;
+  merge_scan_cnt = merge_cnt = unmerge_cnt = 0;
+  exec_cache_cnt = 0;
+  exec_cache_hit_cnt = exec_cache_reclaim_cnt = 0;
+  evict_hand = 0;
+  evict_cnt = 0;
+  lent_hand = 0;
+  lent_evict_cnt = 0;
+  rss_limit = RSS_LIMIT_NONE;
+  self_evict_cnt = 0;
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  zero_map_cnt = 0;
+  slab_cache_init (&page_struct_cache, "page_struct",
+                   sizeof (struct page_struct), NULL);
+  slab_cache_init (&frame_struct_cache, "frame_struct",
+                   sizeof (struct frame_struct), frame_struct_ctor);
+  slab_cache_set_type_stable (&frame_struct_cache);
+}
+
+/* Constructor of frame structures in frame_struct_cache */
+static void
+frame_struct_ctor (void *fs_)
+{
+  struct frame_struct *fs = fs_;
+
+  lock_init (&fs->frame_lock);
+  fs->ptes = &fs->pte_one;
+  fs->pte_cnt = 0;
+  fs->pte_cap = 1;
+  fs->owner = NULL;
+  fs->pin_cnt = 0;
+}
+
+/* Give FS back to frame_struct_cache.  A frame is never freed
+   pinned, but the pin count is reset all the same, since the
+   constructor does not run again when the object is reused */
+static void
+frame_struct_free (struct frame_struct *fs)
+{
+  if (fs == NULL)
+    return;
+  ASSERT (fs->pin_cnt == 0);
+  fs->pin_cnt = 0;
+  slab_free (&frame_struct_cache, fs);
+}
+
+/* Set the soft limit on the resident frames of each process to
+   LIMIT frames, or RSS_LIMIT_NONE, or RSS_LIMIT_WS to follow the
+   working set of each process */
+void
+frame_rss_init (size_t limit)
+{
+  rss_limit = limit;
+}
+
+/* Initialize the supplemental page table of the current process,
+   each process owns its table and the lock protecting it */
+bool
+sup_pt_create (void)
+{
+  struct thread *t = thread_current ();
+
+  lock_init (&t->sup_pt_lock);
+  return hash_init (&t->sup_pt, sup_pt_hash_func, sup_pt_less_func, NULL);
+}
+
+/* Drop the whole supplemental page table of the current process
+   in one pass, releasing the frames and swap slots no one else
+   shares.  Only pages the process tracked are visited, and what
+   they leave behind is released in batches.  Called before
+   pagedir_destroy (), which then only frees the page tables */
+void
+sup_pt_destroy (void)
+{
+  struct thread *t = thread_current ();
+  struct release_batch batch;
+
+  /* Kernel threads never had a table */
+  if (t->sup_pt.buckets == NULL)
+    return;
+
+  batch.fs_cnt = batch.slot_cnt = 0;
+  lock_acquire (&t->sup_pt_lock);
+  t->sup_pt.aux = &batch;
+  hash_destroy (&t->sup_pt, sup_pt_destroy_func);
+  t->sup_pt.buckets = NULL;
+  lock_release (&t->sup_pt_lock);
+  release_batch_flush (&batch);
 }
 
 /* Given pd and virtual address, find the page table entry */
@@ -81,20 +318,40 @@ sup_pt_pte_lookup (uint32_t *pd, const void *vaddr, bool create)
   return &pt[pt_no (vaddr)];
 }
 
-/* Given pte, find the corresonding page_struct entry */
+/* Given pte, find the corresonding page_struct entry
+   in the current process's supplemental page table */
 struct page_struct *
 sup_pt_ps_lookup (uint32_t *pte)
 {
+  struct thread *t = thread_current ();
   struct page_struct ps;
   ps.key = (uint32_t)pte;
 
-  lock_acquire (&sup_pt_lock);
-  struct hash_elem *e = hash_find (&sup_pt, &ps.elem);
-  lock_release (&sup_pt_lock);
+  lock_acquire (&t->sup_pt_lock);
+  struct hash_elem *e = hash_find (&t->sup_pt, &ps.elem);
+  lock_release (&t->sup_pt_lock);
 
   return (e != NULL) ? hash_entry (e, struct page_struct, elem) : NULL;
 }
 
+/* Lock and return the frame of PS, a page of the current process.
+   The merge scanner may move the page to another frame until its
+   frame is locked, and free the one it was on, so the frame read
+   is checked once locked and the lock taken again if it moved */
+struct frame_struct *
+sup_pt_lock_frame (struct page_struct *ps)
+{
+  for (;;)
+    {
+      struct frame_struct *fs = ps->fs;
+
+      lock_acquire (&fs->frame_lock);
+      if (ps->fs == fs)
+        return fs;
+      lock_release (&fs->frame_lock);
+    }
+}
+
 /* Create an entry to sup_pt, according to the given info */
 struct page_struct * 
 sup_pt_add (uint32_t *pd, void *upage, uint8_t *vaddr, size_t length,
@@ -103,52 +360,51 @@ sup_pt_add (uint32_t *pd, void *upage, uint8_t *vaddr, size_t length,
   /* Find pte */
   uint32_t *pte = sup_pt_pte_lookup (pd, upage, true);
 
-  /* Allocate page_struct, i.e., a new entry in sup_pt */
-  struct page_struct *ps =
-    (struct page_struct*) malloc (sizeof (struct page_struct));
-  if (ps == NULL)
+  if (pte == NULL)
     return NULL;
 
-  /* Fill in sup_pt entry info */
-  ps->key = (uint32_t) pte;
-  ps->fs = malloc (sizeof (struct frame_struct));
-  
-  if (ps->fs == NULL)
+  /* Allocate page_struct, i.e., a new entry in sup_pt, and its
+     frame_struct */
+  struct page_struct *ps = slab_alloc (&page_struct_cache);
+  struct frame_struct *fs = slab_alloc (&frame_struct_cache);
+  if (ps == NULL || fs == NULL)
   {
-    free (ps);
+    slab_free (&page_struct_cache, ps);
+    frame_struct_free (fs);
     return NULL;
   }
 
-  lock_init (&ps->fs->frame_lock);
+  /* Fill in sup_pt entry info */
+  ps->key = (uint32_t) pte;
+  ps->fs = fs;
+
   lock_acquire (&ps->fs->frame_lock);
   ps->fs->vaddr = vaddr;
   ps->fs->length = length;
   ps->fs->flag = flag;
   ps->fs->sector_no = sector_no; 
-  list_init (&ps->fs->pte_list);
 
-  /* Register the page itself to pte_list of frame_struct */
-  struct pte_shared *pshr =
-    (struct pte_shared *)malloc (sizeof (struct pte_shared));
-  if (pshr == NULL)
-  {
-    free (ps->fs);
-    free (ps);
-    return NULL;
-  }
-  pshr->pte = pte;
-  list_push_back (&ps->fs->pte_list, &pshr->elem);
+  /* Register the page itself in the reverse map of frame_struct,
+     its first entry never needs memory */
+  frame_rmap_add (ps->fs, pte, upage);
+  if ((*pte & PTE_P) == 0)
+    *pte = pte_create_frame (ps->fs);
   lock_release (&ps->fs->frame_lock);
 
   /* Register at supplemental page table */
-  lock_acquire (&sup_pt_lock);
-  hash_insert (&sup_pt, &ps->elem);
-  lock_release (&sup_pt_lock);
+  struct thread *t = thread_current ();
+  lock_acquire (&t->sup_pt_lock);
+  hash_insert (&t->sup_pt, &ps->elem);
+  lock_release (&t->sup_pt_lock);
 
-  /* Register at frame table */
-  lock_acquire (&frame_list_lock);
-  list_push_back (&frame_list, &ps->fs->elem);
-  lock_release (&frame_list_lock);
+  /* Make the frame available for sharing, unless another
+     frame already stands for the same sector */
+  if (frame_is_shareable (flag))
+    {
+      lock_acquire (&exec_index_lock);
+      hash_insert (&exec_index, &ps->fs->exec_elem);
+      lock_release (&exec_index_lock);
+    }
 
   return ps;
 }
@@ -165,7 +421,8 @@ sup_pt_find_and_delete (uint32_t *pd, void *upage)
     return false;
 }
 
-/* Delete an entry from sup_pt, given pte */
+/* Delete an entry from sup_pt, given pte
+   return true if it was the last entry pointing to its frame */
 bool
 sup_pt_delete (uint32_t *pte)
 { 
@@ -173,59 +430,137 @@ sup_pt_delete (uint32_t *pte)
   if (ps == NULL)
     return false;
 
-/* bool value pin denotes whether current function pins a frame or not */
-  bool pin = false; 
+  struct thread *t = thread_current ();
+  lock_acquire (&t->sup_pt_lock);
+  hash_delete (&t->sup_pt, &ps->elem);
+  lock_release (&t->sup_pt_lock);
+
+  bool last_entry = sup_pt_unlink (ps, NULL);
+  slab_free (&page_struct_cache, ps);
+  return last_entry;
+}
 
-  lock_acquire (&ps->fs->frame_lock);  // frame lock acquire
-  if ((ps->fs->flag & FS_PINNED) == 0)
+/* Remove the pte of PS from the reverse map of its frame_struct,
+   release the frame_struct when this was the last entry, right
+   away or as part of BATCH if not NULL.  A clean executable frame
+   goes to the exec page cache instead.
+   Return true if it was the last entry and its page is released */
+static bool
+sup_pt_unlink (struct page_struct *ps, struct release_batch *batch)
+{
+  struct frame_struct *fs = sup_pt_lock_frame (ps);
+  uint32_t *pte = (uint32_t *) ps->key;
+  bool last_entry = false;
+
+  fs->flag |= FS_PINNED;  /* Pin the frame, which is about to be deleted */
+
+  /* Synch dirty and access bit, a pte that is not present no
+     longer points to the frame */
+  if ((*pte & PTE_P) == 0)
+    *pte = 0;
+  if (*pte & PTE_D)
+    fs->flag |= FS_DIRTY;
+  if (*pte & PTE_A)
+    fs->flag |= FS_ACCESS;
+
+  /* The process leaving the frame is no longer charged for it */
+  if (fs->owner == thread_current ())
+    frame_uncharge (fs);
+  last_entry = frame_rmap_remove (fs, pte) && fs->pte_cnt == 0;
+
+  /* Keep the frame for the next process running the program */
+  if (last_entry && frame_exec_cache_put (fs))
   {
-     pin = true;
-     ps->fs->flag |= FS_PINNED;  /* Pin the frame, which is about to be deleted */
+    fs->flag &= ~FS_PINNED;
+    lock_release (&fs->frame_lock);
+    return false;
   }
-  bool last_entry = false;  /* Last entry pointing to a frame_struct */
-  struct list *list = &ps->fs->pte_list;
-  struct list_elem *e;
-  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+
+  if (last_entry)  /* Special case: removed the last element */
+  {
+    /* Drop from the exec index, if this frame is the one indexed */
+    if (frame_is_shareable (fs->flag))
+      {
+        lock_acquire (&exec_index_lock);
+        struct hash_elem *e = hash_find (&exec_index, &fs->exec_elem);
+        if (e == &fs->exec_elem)
+          hash_delete (&exec_index, e);
+        lock_release (&exec_index_lock);
+      }
+    lock_release (&fs->frame_lock);
+
+    /* Drop from frame table, the frame stays pinned until then so
+       the clock hand passes it by.  Without a batch, the caller
+       frees the page itself */
+    if (batch != NULL)
+      release_batch_add (batch, fs);
+    else
+      {
+        if ((fs->flag & POSBITS) == POS_MEM && fs->vaddr != NULL)
+          frame_table_set (fs->vaddr, fs, NULL);
+        frame_struct_free (fs);
+      }
+  }
+  else
   {
-    struct pte_shared *pte_shared = list_entry (e, struct pte_shared, elem);
-    if (pte_shared->pte == pte)
+    fs->flag &= ~FS_PINNED;
+    lock_release (&fs->frame_lock);
+  }
+  return last_entry;
+}
+
+/* Destructor for the entries left in a supplemental page table
+   when the process exits, see sup_pt_destroy () */
+static void
+sup_pt_destroy_func (struct hash_elem *elem, void *batch)
+{
+  struct page_struct *ps = hash_entry (elem, struct page_struct, elem);
+  sup_pt_unlink (ps, batch);
+  slab_free (&page_struct_cache, ps);
+}
+
+/* Add FS, just unlinked for good, to BATCH along with its swap
+   slot, releasing the batch once full */
+static void
+release_batch_add (struct release_batch *batch, struct frame_struct *fs)
+{
+  if ((fs->flag & POSBITS) == POS_SWAP && (fs->flag & FS_ZERO) == 0)
+    batch->slots[batch->slot_cnt++] = fs->sector_no;
+  batch->frames[batch->fs_cnt++] = fs;
+  if (batch->fs_cnt == RELEASE_BATCH)
+    release_batch_flush (batch);
+}
+
+/* Release the frames of BATCH, their pages and their swap slots,
+   taking each lock once for the whole batch */
+static void
+release_batch_flush (struct release_batch *batch)
+{
+  size_t i;
+
+  lock_acquire (&frame_table_lock);
+  for (i = 0; i < batch->fs_cnt; i++)
     {
-      /* Synch dirty and access bit */
-      if (*pte & PTE_D)
-        {
-          ps->fs->flag |= FS_DIRTY;
-        }
-      if (*pte & PTE_A)
+      struct frame_struct *fs = batch->frames[i];
+      if ((fs->flag & POSBITS) == POS_MEM && fs->vaddr != NULL)
         {
-          ps->fs->flag |= FS_ACCESS;
+          size_t idx = palloc_user_page_no (fs->vaddr);
+          if (frame_table[idx] == fs)
+            frame_table[idx] = NULL;
         }
+    }
+  lock_release (&frame_table_lock);
 
-      /* Remove and release resource */
-      list_remove (&pte_shared->elem);
-      free (pte_shared);
-      if (list_empty (list))  /* Special case: removed the last element */
-      {
-        last_entry = true;
-        lock_acquire (&frame_list_lock);
-        list_remove (&ps->fs->elem);
-        lock_release (&frame_list_lock);
+  swap_release (batch->slots, batch->slot_cnt);
 
-        lock_release (&ps->fs->frame_lock); // frame lock release
-        free (ps->fs);
-      }
-      
-      lock_acquire (&sup_pt_lock);
-      hash_delete (&sup_pt, &ps->elem);
-      lock_release (&sup_pt_lock);
-      free (ps);
-      ps = NULL;
-      break;
+  for (i = 0; i < batch->fs_cnt; i++)
+    {
+      struct frame_struct *fs = batch->frames[i];
+      if ((fs->flag & POSBITS) == POS_MEM && fs->vaddr != NULL)
+        palloc_free_page (fs->vaddr);
+      frame_struct_free (fs);
     }
-  }
-  if  (ps != NULL)
-    lock_release (&ps->fs->frame_lock);  //frame lock release
-
-  return last_entry;
+  batch->fs_cnt = batch->slot_cnt = 0;
 }
 
 /* Used when swapping in, map the pages to frame in memeory */
@@ -235,6 +570,8 @@ sup_pt_set_swap_in (struct frame_struct *fs, void *kpage)
   fs->vaddr = kpage;
   fs->flag = (fs->flag & POSMASK) | POS_MEM;
   sup_pt_fs_set_pte_list (fs, kpage, true);
+  if (frame_table_set (kpage, NULL, fs))
+    frame_charge (fs, thread_current ());
   fs->flag &= ~FS_PINNED;
 }
 
@@ -245,11 +582,13 @@ sup_pt_set_swap_out (struct frame_struct *fs,
                      block_sector_t sector_no,
                      bool is_on_disk)
 {
+  if (fs->vaddr != NULL)
+    frame_table_set (fs->vaddr, fs, NULL);
+  frame_uncharge (fs);
   fs->vaddr = NULL;
   fs->sector_no = sector_no;
   fs->flag = (fs->flag & POSMASK) | (is_on_disk ? POS_DISK : POS_SWAP);
   sup_pt_fs_set_pte_list (fs, NULL, false);
-
 }
 
 /* Set up mapping from kpage to the frame associated with pte */
@@ -263,6 +602,44 @@ sup_pt_set_memory_map (uint32_t *pte, void *kpage)
   return true;
 }
 
+/* Return the frame_struct of a tracked page whose PTE is not
+   present, or NULL if PTE is present or not tracked.  The frame
+   stays valid as long as the pte is not deleted, which only the
+   process owning it does */
+struct frame_struct *
+sup_pt_pte_frame (const uint32_t *pte)
+{
+  uint32_t entry = *pte;
+
+  if ((entry & PTE_P) != 0 || entry == 0)
+    return NULL;
+  return (struct frame_struct *) entry;
+}
+
+/* Map PTE, of a page of FS, to the shared zero page, read only.
+   FS must be locked, hold FS_ZERO, and not be in memory.  The
+   first write to the page faults, and then gets a frame of its
+   own, see page_fault () */
+void
+sup_pt_map_zero_page (struct frame_struct *fs, uint32_t *pte)
+{
+  ASSERT (lock_held_by_current_thread (&fs->frame_lock));
+  ASSERT ((fs->flag & FS_ZERO) != 0);
+  ASSERT ((fs->flag & POSBITS) != POS_MEM);
+
+  /* The pte was not present, so there is nothing to flush */
+  *pte = pte_create_user (zero_page, false) | PTE_A;
+  zero_map_cnt++;
+}
+
+/* Return true if KPAGE is the shared zero page, which must not
+   be freed when the pte's mapping it go away */
+bool
+sup_pt_is_zero_page (const void *kpage)
+{
+  return kpage == zero_page;
+}
+
 /* Determine if a frame is dirty return true when
         fs->flag indicates dirty or
         any one of the pte's indicates dirty */
@@ -275,14 +652,11 @@ sup_pt_fs_is_dirty (struct frame_struct *fs)
       return true;
     }
 
-  struct list *list = &fs->pte_list;
-  struct list_elem *e;
-  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+  size_t i;
+  for (i = 0; i < fs->pte_cnt; i++)
   {
-    struct pte_shared *pte_shared = list_entry (e, struct pte_shared, elem);
-
-    /* Found a dirty pte */
-    if ((*pte_shared->pte & PTE_D) != 0)
+    /* Found a dirty pte, only present ones hold the bit */
+    if ((*fs->ptes[i].pte & (PTE_P | PTE_D)) == (PTE_P | PTE_D))
       {
         /* Set frame_struct flag is enough for future query */
         /* Refer to sup_pt_delete() for synching dirty bit */
@@ -293,80 +667,608 @@ sup_pt_fs_is_dirty (struct frame_struct *fs)
   return false;
 }
 
+/* Clear the dirty bits of FS, which must be locked, and of its
+   pte's, after its content was written back */
+void
+sup_pt_fs_clear_dirty (struct frame_struct *fs)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&fs->frame_lock));
+
+  fs->flag &= ~FS_DIRTY;
+  for (i = 0; i < fs->pte_cnt; i++)
+    if ((*fs->ptes[i].pte & (PTE_P | PTE_D)) == (PTE_P | PTE_D))
+      {
+        *fs->ptes[i].pte &= ~PTE_D;
+        pagedir_invalidate_pte (fs->ptes[i].pte, fs->ptes[i].upage);
+      }
+}
+
+/* Clear the accessed bits of FS, which must be locked, so the
+   clock hand takes it without a second chance */
+void
+sup_pt_fs_deactivate (struct frame_struct *fs)
+{
+  ASSERT (lock_held_by_current_thread (&fs->frame_lock));
+
+  sup_pt_fs_scan_and_reset_access (fs);
+}
+
+/* Fault in the user pages holding SIZE bytes from UADDR of the
+   current process, writable if WRITE, and pin their frames until
+   sup_pt_unpin (), so the kernel can access them while holding
+   locks the page fault handler needs.  A page that is not valid
+   kills the process, as the access by the kernel would have,
+   so this must not be called with such locks held.  The whole
+   range is faulted in before the first pin is taken, so a process
+   killed that way never leaves pins behind */
+void
+sup_pt_pin (const void *uaddr, size_t size, bool write)
+{
+  struct thread *t = thread_current ();
+  const void *end = uaddr + size;
+  const void *upage;
+
+  if (size == 0)
+    return;
+
+  for (upage = pg_round_down (uaddr); upage < end; upage += PGSIZE)
+    sup_pt_touch (upage > uaddr ? upage : uaddr, write);
+
+  for (upage = pg_round_down (uaddr); upage < end; upage += PGSIZE)
+    for (;;)
+      {
+        uint32_t *pte = sup_pt_pte_lookup (t->pagedir, upage, false);
+        struct page_struct *ps = pte != NULL ? sup_pt_ps_lookup (pte) : NULL;
+
+        if (ps != NULL)
+          {
+            struct frame_struct *fs = sup_pt_lock_frame (ps);
+            bool pinned = false;
+
+            if ((*pte & PTE_P) != 0 && (!write || (*pte & PTE_W) != 0))
+              {
+                fs->pin_cnt++;
+                pinned = true;
+              }
+            lock_release (&fs->frame_lock);
+            if (pinned)
+              break;
+          }
+
+        /* Evicted again meanwhile, which cannot kill the process
+           now that the page is known to be valid */
+        sup_pt_touch (upage > uaddr ? upage : uaddr, write);
+      }
+}
+
+/* Release the pins sup_pt_pin () took on SIZE bytes from UADDR */
+void
+sup_pt_unpin (const void *uaddr, size_t size)
+{
+  struct thread *t = thread_current ();
+  const void *end = uaddr + size;
+  const void *upage;
+
+  if (size == 0)
+    return;
+
+  for (upage = pg_round_down (uaddr); upage < end; upage += PGSIZE)
+    {
+      uint32_t *pte = sup_pt_pte_lookup (t->pagedir, upage, false);
+      struct page_struct *ps = sup_pt_ps_lookup (pte);
+
+      ASSERT (ps != NULL);
+      lock_acquire (&ps->fs->frame_lock);
+      ASSERT (ps->fs->pin_cnt > 0);
+      ps->fs->pin_cnt--;
+      lock_release (&ps->fs->frame_lock);
+    }
+}
+
+/* Clear FS_PINNED on the frame of UPAGE of the current process,
+   marked with it by the kernel to fill the page in before any
+   fault on it can be handled */
+void
+sup_pt_clear_pinned (const void *upage)
+{
+  struct thread *t = thread_current ();
+  uint32_t *pte = sup_pt_pte_lookup (t->pagedir, upage, false);
+  struct page_struct *ps = pte != NULL ? sup_pt_ps_lookup (pte) : NULL;
+  struct frame_struct *fs;
+
+  if (ps == NULL)
+    return;
+  fs = sup_pt_lock_frame (ps);
+  fs->flag &= ~FS_PINNED;
+  lock_release (&fs->frame_lock);
+}
+
+/* Access the byte at UADDR the way the process would, to fault in
+   its page.  A write is done by a locked read-modify-write that
+   leaves the byte as it is, and faults as a write */
+static void
+sup_pt_touch (const void *uaddr, bool write)
+{
+  if (write)
+    asm volatile ("lock orb $0, %0" : "+m" (*(uint8_t *) uaddr));
+  else
+    (void) *(volatile const uint8_t *) uaddr;
+}
+
+/* Duplicate the address space of PARENT into the current process,
+   which has a fresh page directory and supplemental page table.
+   Read only frames are shared as they are, writable ones become
+   copy on write: both processes map them read only until either
+   writes, see sup_pt_break_cow ().  Memory mapped files are not
+   inherited.  PARENT must stay blocked meanwhile */
+bool
+sup_pt_fork (struct thread *parent)
+{
+  struct hash_iterator i;
+  bool success = true;
+
+  lock_acquire (&parent->sup_pt_lock);
+  hash_first (&i, &parent->sup_pt);
+  while (success && hash_next (&i))
+    success = sup_pt_fork_page (hash_entry (hash_cur (&i),
+                                            struct page_struct, elem));
+  lock_release (&parent->sup_pt_lock);
+
+  return success;
+}
+
+/* Share the frame of PPS, a page of the parent process, with the
+   same user page of the current process */
+static bool
+sup_pt_fork_page (struct page_struct *pps)
+{
+  struct thread *t = thread_current ();
+  struct frame_struct *fs = sup_pt_lock_frame (pps);
+  uint32_t *ppte = (uint32_t *) pps->key;
+  struct page_struct *ps = NULL;
+  bool success = false;
+
+  if ((fs->flag & TYPEBITS) == TYPE_MMFile)
+    {
+      success = true;
+      goto done;
+    }
+
+  void *upage = sup_pt_fs_find_pte (fs, ppte)->upage;
+  uint32_t *pte = sup_pt_pte_lookup (t->pagedir, upage, true);
+  ps = slab_alloc (&page_struct_cache);
+  if (pte == NULL || ps == NULL || !frame_rmap_add (fs, pte, upage))
+    goto done;
+
+  /* From now on the parent may only read a writable page */
+  if ((fs->flag & FS_READONLY) == 0)
+    {
+      fs->flag |= FS_COW;
+      if ((*ppte & PTE_W) != 0)
+        {
+          *ppte &= ~PTE_W;
+          pagedir_invalidate_pte (ppte, upage);
+        }
+    }
+
+  /* The pte was not present, so there is nothing to flush */
+  if ((fs->flag & POSBITS) == POS_MEM)
+    *pte = pte_create_user (fs->vaddr, false) | PTE_A;
+  else
+    *pte = pte_create_frame (fs);
+
+  ps->key = (uint32_t) pte;
+  ps->fs = fs;
+  lock_acquire (&t->sup_pt_lock);
+  hash_insert (&t->sup_pt, &ps->elem);
+  lock_release (&t->sup_pt_lock);
+  success = true;
+
+ done:
+  lock_release (&fs->frame_lock);
+  if (!success)
+    slab_free (&page_struct_cache, ps);
+  return success;
+}
+
+/* Handle a write to a copy on write page: give the pte of PS a
+   private frame with a copy of the shared one, or simply make it
+   writable if no one else shares the frame any more.
+   The frame of PS must be locked.  On return ps->fs, which may be
+   a new frame, is locked and the old frame is not */
+bool
+sup_pt_break_cow (struct page_struct *ps)
+{
+  struct frame_struct *fs = ps->fs;
+  uint32_t *pte = (uint32_t *) ps->key;
+  void *upage = sup_pt_fs_find_pte (fs, pte)->upage;
+
+  ASSERT (lock_held_by_current_thread (&fs->frame_lock));
+  ASSERT ((fs->flag & FS_COW) != 0);
+
+  if ((fs->flag & FS_MERGED) != 0)
+    unmerge_cnt++;
+
+  /* Last one sharing the frame, take it over */
+  if (fs->pte_cnt == 1)
+    {
+      fs->flag &= ~(FS_COW | FS_MERGED);
+      if ((fs->flag & POSBITS) == POS_MEM)
+        sup_pt_set_swap_in (fs, fs->vaddr);
+      else
+        {
+          /* Mapped to the zero page, fault again for a frame */
+          *pte = pte_create_frame (fs);
+          pagedir_invalidate_pte (pte, upage);
+        }
+      return true;
+    }
+
+  struct frame_struct *new_fs = slab_alloc (&frame_struct_cache);
+  if (new_fs == NULL)
+    return false;
+  uint8_t *kpage = frame_get_page ();
+  if (kpage == NULL)
+    {
+      frame_struct_free (new_fs);
+      return false;
+    }
+
+  /* The shared frame is either in memory or the zero page */
+  if ((fs->flag & POSBITS) == POS_MEM)
+    memcpy (kpage, fs->vaddr, PGSIZE);
+  else
+    memset (kpage, 0, PGSIZE);
+
+  lock_acquire (&new_fs->frame_lock);
+  new_fs->flag = fs->flag & ~(FS_COW | FS_MERGED | FS_PINNED);
+  if (sup_pt_fs_is_dirty (fs))
+    new_fs->flag |= FS_DIRTY;
+  new_fs->vaddr = NULL;
+  new_fs->length = fs->length;
+  new_fs->sector_no = fs->sector_no;
+
+  /* Move the pte over to the copy */
+  frame_rmap_add (new_fs, pte, upage);
+  frame_rmap_remove (fs, pte);
+  if (fs->owner == thread_current ())
+    frame_uncharge (fs);
+  ps->fs = new_fs;
+  sup_pt_set_swap_in (new_fs, kpage);
+
+  /* A single process left on the old frame may write to it again */
+  if (fs->pte_cnt == 1)
+    {
+      fs->flag &= ~(FS_COW | FS_MERGED);
+      if ((fs->flag & POSBITS) == POS_MEM)
+        sup_pt_set_swap_in (fs, fs->vaddr);
+    }
+  fs->flag &= ~FS_PINNED;
+  lock_release (&fs->frame_lock);
+  return true;
+}
+
+/* Find the entry for PTE in the reverse map of FS, which must
+   hold it.  The entry moves when the map changes */
+static struct pte_shared *
+sup_pt_fs_find_pte (struct frame_struct *fs, uint32_t *pte)
+{
+  size_t i;
+
+  for (i = 0; i < fs->pte_cnt; i++)
+    if (fs->ptes[i].pte == pte)
+      return &fs->ptes[i];
+  NOT_REACHED ();
+}
+
+/* Add PTE, mapping UPAGE, to the reverse map of FS.  The first
+   pte is kept in the frame itself, more spill into an array
+   that doubles as needed.  Returns false if out of memory */
+static bool
+frame_rmap_add (struct frame_struct *fs, uint32_t *pte, void *upage)
+{
+  if (fs->pte_cnt == fs->pte_cap)
+    {
+      size_t cap = fs->pte_cap < 4 ? 4 : fs->pte_cap * 2;
+      struct pte_shared *ptes = malloc (cap * sizeof *ptes);
+      if (ptes == NULL)
+        return false;
+      memcpy (ptes, fs->ptes, fs->pte_cnt * sizeof *ptes);
+      if (fs->ptes != &fs->pte_one)
+        free (fs->ptes);
+      fs->ptes = ptes;
+      fs->pte_cap = cap;
+    }
+
+  fs->ptes[fs->pte_cnt].pte = pte;
+  fs->ptes[fs->pte_cnt].upage = upage;
+  fs->pte_cnt++;
+  return true;
+}
+
+/* Remove PTE from the reverse map of FS, going back to the entry
+   in the frame itself once at most one pte is left.  Returns
+   false if PTE was not in the map */
+static bool
+frame_rmap_remove (struct frame_struct *fs, uint32_t *pte)
+{
+  size_t i;
+
+  for (i = 0; i < fs->pte_cnt; i++)
+    if (fs->ptes[i].pte == pte)
+      break;
+  if (i == fs->pte_cnt)
+    return false;
+
+  fs->ptes[i] = fs->ptes[--fs->pte_cnt];
+  if (fs->pte_cnt <= 1 && fs->ptes != &fs->pte_one)
+    {
+      if (fs->pte_cnt == 1)
+        fs->pte_one = fs->ptes[0];
+      free (fs->ptes);
+      fs->ptes = &fs->pte_one;
+      fs->pte_cap = 1;
+    }
+  return true;
+}
+
+/* Get a frame from the user pool for a page about to be brought
+   in, evicting another frame if the pool is empty */
+uint8_t *
+frame_get_page (void)
+{
+  uint8_t *kpage = NULL;
+
+  /* A process over its soft limit replaces its own frames once
+     memory runs short, instead of growing at the expense of others */
+  if (frame_over_limit (thread_current ()) && pageout_short ())
+    kpage = frame_evict (thread_current ());
+  if (kpage == NULL)
+    kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+
+  /* Let the pageout daemon refill the pool ahead of demand */
+  pageout_check ();
+
+  /* Out of free frames after all, evict one ourselves */
+  if (kpage == NULL)
+    kpage = sup_pt_evict_frame ();
+  return kpage;
+}
+
 /* Evict a frame
    return the freed virtual address, which can be used by others */
 uint8_t *
 sup_pt_evict_frame ()
 {
-  struct list *list = &frame_list;
-  struct list_elem *e;
-  struct frame_struct *victim;
+  uint8_t *kpage;
+
+  /* Every frame is busy or pinned, let their owners proceed */
+  while ((kpage = sup_pt_try_evict_frame ()) == NULL)
+    thread_yield ();
+  return kpage;
+}
 
-  /* Get evict_pointer, initialize if necessary */
-  if (evict_pointer == NULL)
+/* Evict a frame like sup_pt_evict_frame (), but return NULL
+   instead of waiting if every frame is busy or pinned */
+uint8_t *
+sup_pt_try_evict_frame (void)
+{
+  uint8_t *kpage;
+
+  /* Frames no process maps go first */
+  kpage = frame_exec_cache_reclaim (false);
+  if (kpage != NULL)
+    return kpage;
+  return frame_evict (NULL);
+}
+
+/* Evict a frame in a page the kernel pool lent to the user pool,
+   and return its page, which the caller gives back to the kernel
+   pool.  Frames of the exec page cache go first, as they are not
+   in the frame table.  Return NULL if every such frame is busy or
+   pinned, or there is none left */
+uint8_t *
+sup_pt_evict_lent (void)
+{
+  struct frame_struct *victim = NULL;
+  uint8_t *kpage;
+  size_t i;
+
+  kpage = frame_exec_cache_reclaim (true);
+  if (kpage != NULL)
     {
-      lock_acquire (&frame_list_lock);
-      e = list_begin (list); 
-      evict_pointer = list_entry (e, struct frame_struct, elem);
-      lock_release (&frame_list_lock);
+      lent_evict_cnt++;
+      return kpage;
     }
-  e = &evict_pointer->elem;
 
-  while (true)
+  lock_acquire (&frame_table_lock);
+  for (i = 0; i < frame_cnt && victim == NULL; i++)
     {
-      /* Circularly update evict_pointer around frame table */
-      lock_acquire (&frame_list_lock);
-      e = list_next (&evict_pointer->elem);
-      if (e == list_end (list))
+      struct frame_struct *fs = frame_table[lent_hand];
+
+      lent_hand = (lent_hand + 1) % frame_cnt;
+      if (fs == NULL || !palloc_page_lent (fs->vaddr)
+          || lock_held_by_current_thread (&fs->frame_lock))
+        continue;
+      if (!lock_try_acquire (&fs->frame_lock))
+        continue;
+
+      /* Pinned frames are skipped, whatever page they are in */
+      if ((fs->flag & FS_PINNED) != 0 || fs->pin_cnt != 0
+          || (fs->flag & POSBITS) != POS_MEM
+          || !palloc_page_lent (fs->vaddr))
         {
-          e = list_begin (list); 
+          lock_release (&fs->frame_lock);
+          continue;
         }
-      evict_pointer = list_entry (e, struct frame_struct, elem);
-      lock_release (&frame_list_lock);
+      victim = fs;
+    }
+  lock_release (&frame_table_lock);
 
-      victim = evict_pointer;
-      if (lock_held_by_current_thread (&victim->frame_lock))
-        continue;
+  if (victim == NULL)
+    return NULL;
 
-      if (!lock_try_acquire (&victim->frame_lock))
-        continue;
+  uint8_t *vaddr = victim->vaddr;
+  evict_cnt++;
+  lent_evict_cnt++;
+  swap_out (victim);
+  return vaddr;
+}
 
-      /* Query PINED bit */
-      if ((evict_pointer->flag & FS_PINNED) != 0)
-      {
-        lock_release (&evict_pointer->frame_lock);
+/* Evict a frame charged to OWNER, or any frame if OWNER is NULL,
+   and return its page.  Return NULL if no frame qualifies within
+   two turns of the clock hand, which are enough to clear the
+   accessed bits of every frame once and come back to one of them */
+static uint8_t *
+frame_evict (struct thread *owner)
+{
+  struct frame_struct *victim = NULL;
+  size_t i;
+
+  lock_acquire (&frame_table_lock);
+  for (i = 0; i < 2 * frame_cnt && victim == NULL; i++)
+    {
+      struct frame_struct *fs = frame_table[evict_hand];
+      bool accessed;
+
+      evict_hand = (evict_hand + 1) % frame_cnt;
+      if (evict_hand == 0)
+        {
+          enum intr_level old_level = intr_disable ();
+          thread_foreach (frame_ws_roll, NULL);
+          intr_set_level (old_level);
+        }
+
+      if (fs == NULL || lock_held_by_current_thread (&fs->frame_lock))
+        continue;
+      if (!lock_try_acquire (&fs->frame_lock))
         continue;
-      }
 
-      /* Frames in memory are candidates for eviction */
-      if ((evict_pointer->flag & POSBITS) == POS_MEM)
-        if (sup_pt_fs_scan_and_reset_access (evict_pointer))
-          break;
-      if (lock_held_by_current_thread (&victim->frame_lock))
-        lock_release (&victim->frame_lock);
-    } 
+      /* Pinned frames are skipped */
+      if ((fs->flag & FS_PINNED) != 0 || fs->pin_cnt != 0
+          || (fs->flag & POSBITS) != POS_MEM
+          || (owner != NULL && fs->owner != owner))
+        {
+          lock_release (&fs->frame_lock);
+          continue;
+        }
+
+      accessed = sup_pt_fs_scan_and_reset_access (fs);
+      if (accessed && fs->owner != NULL)
+        fs->owner->ws_cur++;
+
+      /* Recently accessed frames get a second chance, unless their
+         process holds more than its share */
+      if (!accessed || (owner == NULL && frame_over_limit (fs->owner)))
+        victim = fs;
+      else
+        lock_release (&fs->frame_lock);
+    }
+  lock_release (&frame_table_lock);
+
+  if (victim == NULL)
+    return NULL;
 
   uint8_t *vaddr = victim->vaddr;
+  evict_cnt++;
+  if (owner != NULL)
+    self_evict_cnt++;
   swap_out (victim);
   return vaddr;
 }
 
+/* Replace the frame table slot of KPAGE with NEW_FS,
+   as long as it still holds OLD_FS.  Return true if replaced */
+static bool
+frame_table_set (void *kpage, struct frame_struct *old_fs,
+                 struct frame_struct *new_fs)
+{
+  size_t idx = palloc_user_page_no (kpage);
+  bool replaced = false;
+
+  lock_acquire (&frame_table_lock);
+  if (frame_table[idx] == old_fs)
+    {
+      frame_table[idx] = new_fs;
+      replaced = true;
+    }
+  lock_release (&frame_table_lock);
+  return replaced;
+}
+
+/* Charge FS, which just entered memory and must be locked, to T.
+   Counters of a process are updated by others evicting its
+   frames, so interrupts are off meanwhile */
+static void
+frame_charge (struct frame_struct *fs, struct thread *t)
+{
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (fs->owner == NULL);
+  fs->owner = t;
+  t->rss_cnt++;
+  intr_set_level (old_level);
+}
+
+/* Stop charging FS, which must be locked, to its process */
+static void
+frame_uncharge (struct frame_struct *fs)
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (fs->owner != NULL)
+    {
+      fs->owner->rss_cnt--;
+      fs->owner = NULL;
+    }
+  intr_set_level (old_level);
+}
+
+/* Whether T holds more resident frames than its soft limit */
+static bool
+frame_over_limit (const struct thread *t)
+{
+  size_t limit = rss_limit;
+
+  if (t == NULL || rss_limit == RSS_LIMIT_NONE)
+    return false;
+  if (rss_limit == RSS_LIMIT_WS)
+    {
+      /* Leave room for the working set to grow */
+      limit = t->ws_size + t->ws_size / 2;
+      if (limit < RSS_WS_MIN)
+        limit = RSS_WS_MIN;
+    }
+  return t->rss_cnt > limit;
+}
+
+/* Close the working set sample of T at the end of a turn of the
+   clock hand */
+static void
+frame_ws_roll (struct thread *t, void *aux UNUSED)
+{
+  t->ws_size = t->ws_cur;
+  t->ws_cur = 0;
+}
+
 /* Find any accessed pte's associated with frame_struct
    also reset the accessed bits for future use */
 static bool 
 sup_pt_fs_scan_and_reset_access (struct frame_struct *fs)	//***static
 {
   bool flag = false;
-  struct list_elem *e;
+  size_t i;
 
-  struct list *list = &fs->pte_list;
-  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+  for (i = 0; i < fs->pte_cnt; i++)
   {
-    struct pte_shared *pte_shared = list_entry (e, struct pte_shared, elem);
-    if ((*pte_shared->pte & PTE_A) != 0)
+    struct pte_shared *pte_shared = &fs->ptes[i];
+    if ((*pte_shared->pte & (PTE_P | PTE_A)) == (PTE_P | PTE_A))
     {
       flag = true;
       *pte_shared->pte &= ~PTE_A;       /* Reset pte's */
+      pagedir_invalidate_pte (pte_shared->pte, pte_shared->upage);
     }
   }
 
@@ -377,10 +1279,6 @@ sup_pt_fs_scan_and_reset_access (struct frame_struct *fs)	//***static
     fs->flag &= ~FS_ACCESS;             /* Reset frame_struct */
   }
 
-  /* Flush TLB */
-  struct thread* t = thread_current ();
-  pagedir_activate (t->pagedir);
-
   return flag;
 }
 
@@ -392,27 +1290,38 @@ static void
 sup_pt_fs_set_pte_list (struct frame_struct *fs, uint8_t *kpage,
                         bool is_swapping_in)
 {
-  struct list *list = &fs->pte_list;
-  struct list_elem *e;
-  for (e = list_begin (list); e != list_end (list); e = list_next (e))
+  size_t i;
+  for (i = 0; i < fs->pte_cnt; i++)
   {
-    struct pte_shared *pte_shared = list_entry (e, struct pte_shared, elem);
+    struct pte_shared *pte_shared = &fs->ptes[i];
+    bool present = (*pte_shared->pte & PTE_P) != 0;
+    bool dirty = present && (*pte_shared->pte & PTE_D) != 0;
     if (is_swapping_in)
     {
-      bool writable = !(fs->flag & FS_READONLY);
-      bool dirty    = *pte_shared->pte & PTE_D;
+      bool writable = !(fs->flag & (FS_READONLY | FS_COW));
       *pte_shared->pte = pte_create_user (kpage, writable);
       *pte_shared->pte |= PTE_A | (dirty ? PTE_D : 0);
     }
     else 
     {
-      *pte_shared->pte &= ~PTE_P;
+      /* The dirty bit goes with the frame while it is out */
+      if (dirty)
+        fs->flag |= FS_DIRTY;
+      *pte_shared->pte = pte_create_frame (fs);
     }
+
+    /* Only present pte's may be cached in the TLB */
+    if (present)
+      pagedir_invalidate_pte (pte_shared->pte, pte_shared->upage);
   }
+}
 
-  /* Flush TLB */
-  struct thread* t = thread_current ();
-  pagedir_activate (t->pagedir);
+/* Pte content for a page of FS that is not present */
+static inline uint32_t
+pte_create_frame (struct frame_struct *fs)
+{
+  ASSERT (((uint32_t) fs & PTE_P) == 0);
+  return (uint32_t) fs;
 }
 
 /* Hash function used to organize supplemental page table as a hash table */
@@ -448,86 +1357,520 @@ mark_page (void *upage, uint8_t *addr,
          != NULL;
 }
 
-/* Install_page, sharing with others for an exsiting frame */
+/* Install_page, sharing with others for an exsiting frame.
+   FS is locked by a previous frame_lookup_exec (), the lock is
+   released here whether or not the page could be installed */
 bool
 mark_shared_page (void *upage, struct frame_struct *fs)
 {
   struct thread* t = thread_current ();
+  struct page_struct *ps = NULL;
+  uint32_t *pte = NULL;
 
-  if (pagedir_get_page (t->pagedir, upage) != NULL)
-    return false;
+  ASSERT (lock_held_by_current_thread (&fs->frame_lock));
 
-  uint32_t *pd = t->pagedir;
+  if (pagedir_get_page (t->pagedir, upage) != NULL)
+    goto fail;
 
   /* Find pte */
-  uint32_t *pte = sup_pt_pte_lookup (pd, upage, true);
+  pte = sup_pt_pte_lookup (t->pagedir, upage, true);
+  if (pte == NULL)
+    goto fail;
 
-  /* Create page_struct and register in sup_pt */
-  struct page_struct *ps;
-  ps = malloc (sizeof (struct page_struct));
-  if (ps == NULL)
-    return false;
+  /* Create page_struct, and register share memory in frame's
+     reverse map */
+  ps = slab_alloc (&page_struct_cache);
+  if (ps == NULL || !frame_rmap_add (fs, pte, upage))
+    goto fail;
 
+  /* The pte was not present, so there is nothing to flush */
   if ((fs->flag & POSBITS) == POS_MEM)
   {
      *pte =  pte_create_user (fs->vaddr, false);
      *pte |= PTE_P;
      *pte |= PTE_A; 
-     pagedir_activate (t->pagedir);
   }
+  else
+     *pte = pte_create_frame (fs);
+  lock_release (&fs->frame_lock);
 
+  /* Register in sup_pt */
   ps->key = (uint32_t) pte;
   ps->fs = fs;
-  lock_acquire (&sup_pt_lock);
-  hash_insert (&sup_pt, &ps->elem);
-  lock_release (&sup_pt_lock);
+  lock_acquire (&t->sup_pt_lock);
+  hash_insert (&t->sup_pt, &ps->elem);
+  lock_release (&t->sup_pt_lock);
 
-  
-  lock_init (&ps->fs->frame_lock);
-  lock_acquire (&ps->fs->frame_lock);
-  /* Register share memory in frame table */
-  struct pte_shared* pshr =
-    (struct pte_shared*)malloc (sizeof (struct pte_shared));
-  if (pshr == NULL)
+  return true;
+
+ fail:
+  /* A frame just taken from the exec page cache goes back there */
+  if (fs->pte_cnt == 0)
     {
-      free (ps);
-      return false;
+      frame_uncharge (fs);
+      frame_exec_cache_put (fs);
     }
-  pshr->pte = pte;
-  lock_release (&ps->fs->frame_lock);
-
-  lock_acquire (&frame_list_lock);
-
-  list_push_back (&ps->fs->pte_list, &pshr->elem);
-  lock_release (&frame_list_lock);
-
-  return true;
+  lock_release (&fs->frame_lock);
+  slab_free (&page_struct_cache, ps);
+  return false;
 }
 
 /* Lookup for an executable frame with given sector #
-   used for frame sharing */
+   used for frame sharing.
+   Return the frame with its frame_lock held, to be handed over to
+   mark_shared_page (), or NULL if there is no such frame or it is
+   busy (e.g. being evicted or released) at the moment */
 struct frame_struct*
 frame_lookup_exec (block_sector_t sector_to_find, uint32_t flag)
 {
-  if ((flag & TYPEBITS) != TYPE_Executable ||
-      (flag & FS_READONLY) == 0)
+  if (!frame_is_shareable (flag))
+    return NULL;
+
+  struct frame_struct key;
+  struct frame_struct *fs = NULL;
+  struct hash_elem *e;
+
+  key.sector_no = sector_to_find;
+  lock_acquire (&exec_index_lock);
+  e = hash_find (&exec_index, &key.exec_elem);
+  if (e != NULL)
     {
-      return NULL;
+      fs = hash_entry (e, struct frame_struct, exec_elem);
+
+      /* Never wait for a frame while holding the index,
+         its owner may be waiting for us (see sup_pt_unlink ()) */
+      if (!lock_try_acquire (&fs->frame_lock))
+        fs = NULL;
+      else if ((fs->flag & FS_CACHED) != 0)
+        {
+          /* Back from the cache into the frame table */
+          list_remove (&fs->cache_elem);
+          exec_cache_cnt--;
+          exec_cache_hit_cnt++;
+          fs->flag &= ~FS_CACHED;
+          frame_table_set (fs->vaddr, NULL, fs);
+          frame_charge (fs, thread_current ());
+        }
     }
+  lock_release (&exec_index_lock);
+  return fs;
+}
+
+/* Put FS, which is locked and no longer mapped, in the exec page
+   cache if it is a resident shareable frame, and the one indexed
+   for its sector.  Return false if FS does not qualify */
+static bool
+frame_exec_cache_put (struct frame_struct *fs)
+{
+  struct hash_elem *e;
+
+  ASSERT (fs->pte_cnt == 0);
+  if (!frame_is_shareable (fs->flag) || (fs->flag & POSBITS) != POS_MEM
+      || fs->vaddr == NULL)
+    return false;
+
+  lock_acquire (&exec_index_lock);
+  e = hash_find (&exec_index, &fs->exec_elem);
+  if (e == &fs->exec_elem)
+    {
+      frame_table_set (fs->vaddr, fs, NULL);
+      fs->flag |= FS_CACHED;
+      list_push_back (&exec_cache, &fs->cache_elem);
+      exec_cache_cnt++;
+    }
+  lock_release (&exec_index_lock);
+  return e == &fs->exec_elem;
+}
+
+/* Take the oldest frame out of the exec page cache, or the oldest
+   in a page the kernel pool lent if LENT, free it and return its
+   page, or NULL if there is no such frame */
+static uint8_t *
+frame_exec_cache_reclaim (bool lent)
+{
+  struct frame_struct *fs = NULL;
+  struct list_elem *e;
+  uint8_t *kpage;
 
-  struct list_elem* e = NULL;
-  struct frame_struct* fs = NULL;
-  for (e = list_begin (&frame_list); e != list_end (&frame_list);
+  if (exec_cache_cnt == 0)
+    return NULL;
+
+  lock_acquire (&exec_index_lock);
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache);
        e = list_next (e))
     {
-      fs = list_entry (e, struct frame_struct, elem);
-      if ((fs->flag & TYPEBITS) == TYPE_Executable &&   /* Executable */
-          (fs->flag & FS_READONLY) != 0 &&              /* Read only */
-          fs->sector_no == sector_to_find)              /* Right sector # */
+      struct frame_struct *f = list_entry (e, struct frame_struct,
+                                           cache_elem);
+      if (!lent || palloc_page_lent (f->vaddr))
         {
-          return fs;
+          fs = f;
+          list_remove (e);
+          hash_delete (&exec_index, &fs->exec_elem);
+          exec_cache_cnt--;
+          exec_cache_reclaim_cnt++;
+          break;
         }
     }
-  return NULL;
+  lock_release (&exec_index_lock);
+  if (fs == NULL)
+    return NULL;
+
+  kpage = fs->vaddr;
+  fs->vaddr = NULL;
+  frame_exec_cache_free (fs);
+  return kpage;
 }
 
+/* Drop the frames of the exec page cache holding any of the CNT
+   sectors from SECTOR, which are being written or freed, so the
+   cache never serves stale data */
+void
+frame_exec_invalidate (block_sector_t sector, size_t cnt)
+{
+  struct list stale;
+  struct list_elem *e, *next;
+
+  if (exec_cache_cnt == 0)
+    return;
+
+  list_init (&stale);
+  lock_acquire (&exec_index_lock);
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache); e = next)
+    {
+      struct frame_struct *fs = list_entry (e, struct frame_struct,
+                                            cache_elem);
+      next = list_next (e);
+      if (fs->sector_no < sector + cnt
+          && sector < fs->sector_no + PGSIZE / BLOCK_SECTOR_SIZE)
+        {
+          list_remove (e);
+          hash_delete (&exec_index, &fs->exec_elem);
+          exec_cache_cnt--;
+          list_push_back (&stale, e);
+        }
+    }
+  lock_release (&exec_index_lock);
+
+  while (!list_empty (&stale))
+    {
+      struct frame_struct *fs = list_entry (list_pop_front (&stale),
+                                            struct frame_struct, cache_elem);
+      palloc_free_page (fs->vaddr);
+      fs->vaddr = NULL;
+      frame_exec_cache_free (fs);
+    }
+}
+
+/* Free FS, just taken out of the exec page cache.  The process
+   that put it there may still hold its lock for a moment */
+static void
+frame_exec_cache_free (struct frame_struct *fs)
+{
+  lock_acquire (&fs->frame_lock);
+  fs->flag &= ~(FS_CACHED | FS_PINNED);
+  lock_release (&fs->frame_lock);
+  frame_struct_free (fs);
+}
+
+/* Read-only executable frames are shared by sector #,
+   see frame_lookup_exec () */
+static bool
+frame_is_shareable (uint32_t flag)
+{
+  return (flag & TYPEBITS) == TYPE_Executable
+         && (flag & FS_READONLY) != 0;
+}
+
+/* Hash function used to index shareable frames by sector # */
+static unsigned
+exec_index_hash_func (const struct hash_elem *elem, void *aux UNUSED)
+{
+  struct frame_struct *fs = hash_entry (elem, struct frame_struct, exec_elem);
+  return hash_int ((int) fs->sector_no);
+}
+
+/* Comparison function used to index shareable frames by sector # */
+static bool
+exec_index_less_func (const struct hash_elem *a, const struct hash_elem *b,
+                      void *aux UNUSED)
+{
+  struct frame_struct *fsa = hash_entry (a, struct frame_struct, exec_elem);
+  struct frame_struct *fsb = hash_entry (b, struct frame_struct, exec_elem);
+  return fsa->sector_no < fsb->sector_no;
+}
+
+/* Scan the next CNT slots of the frame table for anonymous pages,
+   those of the stack and the writable data of programs, and merge
+   each page with another of identical contents seen before, into
+   a single read only frame shared copy on write through the
+   reverse map.  The first write to a merged page gets it a frame
+   of its own again, see sup_pt_break_cow ().  A page is merged
+   only once its contents did not change since the previous turn,
+   so pages being written are left alone.  Called by the merge
+   daemon, see ksm_init () */
+void
+frame_merge_scan (size_t cnt)
+{
+  while (cnt-- > 0)
+    {
+      struct frame_struct *fs;
+      struct merge_node key, *node;
+      struct hash_elem *e;
+      bool merged;
+      size_t idx;
+
+      lock_acquire (&frame_table_lock);
+      idx = merge_hand;
+      merge_hand = (merge_hand + 1) % frame_cnt;
+      fs = frame_table[idx];
+      if (fs != NULL && !lock_try_acquire (&fs->frame_lock))
+        fs = NULL;
+      lock_release (&frame_table_lock);
+
+      /* Every turn starts over with an empty index */
+      if (merge_hand == 0)
+        hash_clear (&merge_index, merge_node_free);
+
+      if (fs == NULL)
+        continue;
+      merge_scan_cnt++;
+      if (!frame_is_mergeable (fs))
+        {
+          lock_release (&fs->frame_lock);
+          continue;
+        }
+
+      /* Frames already shared never change, others must hold
+         still for a turn */
+      key.sum = hash_bytes (fs->vaddr, PGSIZE);
+      if ((fs->flag & FS_COW) == 0 && key.sum != fs->merge_sum)
+        {
+          fs->merge_sum = key.sum;
+          lock_release (&fs->frame_lock);
+          continue;
+        }
+
+      e = hash_find (&merge_index, &key.elem);
+      if (e == NULL)
+        {
+          lock_release (&fs->frame_lock);
+          node = malloc (sizeof *node);
+          if (node != NULL)
+            {
+              node->sum = key.sum;
+              node->idx = idx;
+              hash_insert (&merge_index, &node->elem);
+            }
+          continue;
+        }
+
+      merged = frame_merge (fs, idx, hash_entry (e, struct merge_node,
+                                                 elem));
+      if (merged)
+        merge_cnt++;
+    }
+}
+
+/* Whether FS, which is locked, may be merged with a frame of the
+   same contents: an anonymous frame in memory that is not pinned,
+   and either private to one process, which has it mapped
+   writable, or already shared copy on write */
+static bool
+frame_is_mergeable (struct frame_struct *fs)
+{
+  uint32_t type = fs->flag & TYPEBITS;
+  uint32_t *pte;
+
+  if ((fs->flag & POSBITS) != POS_MEM
+      || (fs->flag & (FS_READONLY | FS_CACHED | FS_PINNED)) != 0
+      || fs->pin_cnt != 0 || fs->pte_cnt == 0
+      || (type != TYPE_Stack && type != TYPE_Executable))
+    return false;
+  if ((fs->flag & FS_COW) != 0)
+    return true;
+
+  pte = fs->ptes[0].pte;
+  return fs->pte_cnt == 1 && fs->owner != NULL
+         && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W)
+         && pte_get_page (*pte) == fs->vaddr;
+}
+
+/* Merge FS, in slot IDX of the frame table, with the frame in the
+   slot of NODE, whose contents hashed the same.  A frame already
+   shared stays, a private one goes, and the earlier one stays if
+   both are private.  FS is locked, and unlocked or freed on
+   return.  Return true if merged, otherwise NODE takes FS if the
+   slot of NODE changed hands */
+static bool
+frame_merge (struct frame_struct *fs, size_t idx, struct merge_node *node)
+{
+  struct frame_struct *other;
+  bool merged = false;
+
+  lock_acquire (&frame_table_lock);
+  other = frame_table[node->idx];
+  if (other == fs)
+    other = NULL;
+  else if (other != NULL && !lock_try_acquire (&other->frame_lock))
+    {
+      /* Busy for now, try again next turn */
+      lock_release (&frame_table_lock);
+      lock_release (&fs->frame_lock);
+      return false;
+    }
+  lock_release (&frame_table_lock);
+
+  if (other != NULL && frame_is_mergeable (other)
+      && (other->flag & TYPEBITS) == (fs->flag & TYPEBITS))
+    {
+      if ((fs->flag & FS_COW) == 0)
+        merged = frame_merge_into (fs, other);
+      else if ((other->flag & FS_COW) == 0)
+        {
+          merged = frame_merge_into (other, fs);
+          if (merged)
+            {
+              node->idx = idx;
+              other = NULL;
+            }
+        }
+      if (merged && other != NULL)
+        fs = NULL;
+    }
+  else
+    node->idx = idx;
+
+  if (other != NULL)
+    lock_release (&other->frame_lock);
+  if (fs != NULL)
+    lock_release (&fs->frame_lock);
+  return merged;
+}
+
+/* Move the only pte of FROM, a private frame, over to TO, if their
+   contents are the same, and free FROM and its page.  Both are
+   locked and write protected while compared.  The process of FROM
+   must not be busy with its supplemental page table, which is not
+   waited for, as the lock order goes the other way.  Return true
+   if merged, with FROM freed */
+static bool
+frame_merge_into (struct frame_struct *from, struct frame_struct *to)
+{
+  struct thread *t = from->owner;
+  uint32_t *pte = from->ptes[0].pte;
+  void *upage = from->ptes[0].upage;
+  struct page_struct key, *ps = NULL;
+  struct hash_elem *e;
+
+  frame_merge_protect (from, true);
+  if ((to->flag & FS_COW) == 0)
+    frame_merge_protect (to, true);
+  if (memcmp (from->vaddr, to->vaddr, PGSIZE) != 0
+      || !lock_try_acquire (&t->sup_pt_lock))
+    goto fail;
+
+  /* The process still holds FROM charged, so it has not left its
+     supplemental page table yet */
+  key.key = (uint32_t) pte;
+  e = hash_find (&t->sup_pt, &key.elem);
+  if (e != NULL)
+    ps = hash_entry (e, struct page_struct, elem);
+  if (ps == NULL || ps->fs != from || !frame_rmap_add (to, pte, upage))
+    {
+      lock_release (&t->sup_pt_lock);
+      goto fail;
+    }
+  ps->fs = to;
+  lock_release (&t->sup_pt_lock);
+
+  /* The pte was write protected, so only its bits are stale */
+  to->flag |= FS_COW | FS_MERGED;
+  frame_rmap_remove (from, pte);
+  *pte = pte_create_user (to->vaddr, false) | PTE_A;
+  pagedir_invalidate_pte (pte, upage);
+
+  frame_table_set (from->vaddr, from, NULL);
+  frame_uncharge (from);
+  palloc_free_page (from->vaddr);
+  from->vaddr = NULL;
+  from->flag = POS_SWAP;
+  lock_release (&from->frame_lock);
+  frame_struct_free (from);
+  return true;
+
+ fail:
+  frame_merge_protect (from, false);
+  if ((to->flag & FS_COW) == 0)
+    frame_merge_protect (to, false);
+  return false;
+}
+
+/* Write protect the only pte of FS, a private frame mapped
+   writable, if PROTECT, otherwise make it writable again.  A write
+   meanwhile faults, and waits for FS to be unlocked */
+static void
+frame_merge_protect (struct frame_struct *fs, bool protect)
+{
+  uint32_t *pte = fs->ptes[0].pte;
+
+  if (protect)
+    *pte &= ~PTE_W;
+  else
+    *pte |= PTE_W;
+  pagedir_invalidate_pte (pte, fs->ptes[0].upage);
+}
+
+/* Hash function used to index pages by the hash of their contents */
+static unsigned
+merge_index_hash_func (const struct hash_elem *elem, void *aux UNUSED)
+{
+  return hash_entry (elem, struct merge_node, elem)->sum;
+}
+
+/* Comparison function used to index pages by the hash of their
+   contents */
+static bool
+merge_index_less_func (const struct hash_elem *a, const struct hash_elem *b,
+                       void *aux UNUSED)
+{
+  return hash_entry (a, struct merge_node, elem)->sum
+         < hash_entry (b, struct merge_node, elem)->sum;
+}
+
+/* Destructor for the entries of merge_index */
+static void
+merge_node_free (struct hash_elem *elem, void *aux UNUSED)
+{
+  free (hash_entry (elem, struct merge_node, elem));
+}
+
+/* Print frame table statistics */
+void
+frame_print_stats (void)
+{
+  size_t i, resident = 0, saved = 0;
+
+  lock_acquire (&frame_table_lock);
+  for (i = 0; i < frame_cnt; i++)
+    if (frame_table[i] != NULL)
+      {
+        resident++;
+        if ((frame_table[i]->flag & FS_MERGED) != 0)
+          saved += frame_table[i]->pte_cnt - 1;
+      }
+  lock_release (&frame_table_lock);
+
+  printf ("Frames: %zu of %zu resident, %lld evicted, "
+          "%lld zero page mappings\n",
+          resident, frame_cnt, evict_cnt, zero_map_cnt);
+  printf ("Frames: %lld reclaimed by processes over their limit\n",
+          self_evict_cnt);
+  printf ("Frames: %lld given back to the kernel pool\n", lent_evict_cnt);
+  printf ("Exec cache: %zu pages, %lld hits, %lld reclaimed\n",
+          exec_cache_cnt, exec_cache_hit_cnt, exec_cache_reclaim_cnt);
+  printf ("Merging: %lld pages scanned, %lld merged, %lld unmerged, "
+          "%zu kB saved\n",
+          merge_scan_cnt, merge_cnt, unmerge_cnt, saved * PGSIZE / 1024);
+  slab_print_stats (&page_struct_cache);
+  slab_print_stats (&frame_struct_cache);
+}
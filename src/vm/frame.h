@@ -8,6 +8,8 @@
 #include "devices/block.h"
 #include "threads/synch.h"
 
+struct thread;
+
 /* Position of a frame */
 #define POS_SWAP 		0x1
 #define POS_DISK		0x2
@@ -27,11 +29,29 @@
 #define FS_DIRTY		0x20
 #define FS_ACCESS		0x40
 #define FS_ZERO			0x80
+#define FS_COW			0x100
+#define FS_CACHED		0x200	/* In the exec page cache */
+#define FS_MERGED		0x400	/* Shared for identical contents */
 
 #define FS_PINNED		0x10000
 
 #define SECTOR_ERROR		SIZE_MAX
 
+/* Soft limit on the resident frames of each process, see
+   frame_rss_init ().  RSS_LIMIT_WS sizes the limit of each process
+   after its working set, but never below RSS_WS_MIN frames */
+#define RSS_LIMIT_NONE		0
+#define RSS_LIMIT_WS		SIZE_MAX
+#define RSS_WS_MIN		16
+
+/* A pte mapping a frame, with the user page it maps.
+   Unit structure making up the reverse map of a frame structure */
+struct pte_shared
+{
+  uint32_t *pte;
+  void *upage;                  /* User virtual page mapped by pte */
+};
+
 /* A frame structure corresponds to exactly one frame,
    tracking the frame whether it on memeory, disk, or swap.
    Unit structure making up frame table */
@@ -42,11 +62,38 @@ struct frame_struct
   size_t length;                /* Length of meaningful contents */
   block_sector_t sector_no;     /* Sector # if on disk or swap */
   struct lock frame_lock;	/* Lock for protecting data in frame */
-  struct list pte_list;         /* A list of pte's representing
-                                   user pages sharing this frame */
-  struct list_elem elem;
+  struct pte_shared *ptes;      /* Pte's of the user pages sharing
+                                   this frame, either &pte_one, or
+                                   an array once shared */
+  size_t pte_cnt;               /* Number of pte's in ptes */
+  size_t pte_cap;               /* Capacity of ptes */
+  struct pte_shared pte_one;    /* Room for the only pte of a frame
+                                   that is not shared */
+  struct thread *owner;         /* Process charged for the frame while
+                                   in memory, or NULL */
+  size_t pin_cnt;               /* Pins held by the kernel on user
+                                   pages of the frame, see
+                                   sup_pt_pin () */
+  struct hash_elem exec_elem;   /* Element in index of shareable
+                                   executable frames */
+  struct list_elem cache_elem;  /* Element in exec page cache */
+  unsigned merge_sum;           /* Hash of the contents when last
+                                   scanned for merging */
 };
 
+/* The pte of a user page that is tracked but not present holds a
+   pointer to its frame_struct instead, which is word aligned, so
+   PTE_P stays clear.  A fault on the page goes straight from the
+   pte to the frame, see sup_pt_pte_frame (), and a pte of 0 is a
+   page that is not tracked at all.
+
+   The frame of a page_struct changes under the lock of the frame
+   it was, either by its own process or by the merge scanner, see
+   frame_merge_scan ().  Frame structures are type stable, so the
+   frame read from a page_struct can always be locked, but it must
+   be checked to still be the page's once locked, which is what
+   sup_pt_lock_frame () does */
+
 /* A page structure corresponds to on user virtual page,
    it is specific to each process, and maybe more than one page
    strucutre point to a single frame.
@@ -58,18 +105,15 @@ struct page_struct
   struct hash_elem elem;
 };
 
-/* A unit structure representing page pte's
-   sharing a common frame.
-   Unit structure making up pte_list in frame structure */
-struct pte_shared
-{
-  uint32_t *pte;
-  struct list_elem elem;
-};
-
 void
 sup_pt_init (void);
 
+bool
+sup_pt_create (void);
+
+void
+sup_pt_destroy (void);
+
 struct page_struct *
 sup_pt_add (uint32_t *, void *, uint8_t *,
             size_t, uint32_t, block_sector_t);
@@ -86,6 +130,9 @@ sup_pt_pte_lookup (uint32_t *, const void *, bool);
 struct page_struct *
 sup_pt_ps_lookup (uint32_t *);
 
+struct frame_struct *
+sup_pt_lock_frame (struct page_struct *);
+
 void
 sup_pt_set_swap_in  (struct frame_struct *, void *);
 
@@ -95,12 +142,51 @@ sup_pt_set_swap_out (struct frame_struct *, block_sector_t, bool);
 bool
 sup_pt_set_memory_map (uint32_t *, void *);
 
+struct frame_struct *
+sup_pt_pte_frame (const uint32_t *);
+
+void
+sup_pt_map_zero_page (struct frame_struct *, uint32_t *);
+
+bool
+sup_pt_is_zero_page (const void *);
+
 bool
 sup_pt_fs_is_dirty  (struct frame_struct *);
 
+void
+sup_pt_fs_clear_dirty (struct frame_struct *);
+
+void
+sup_pt_fs_deactivate (struct frame_struct *);
+
+void
+sup_pt_pin (const void *, size_t, bool);
+
+void
+sup_pt_unpin (const void *, size_t);
+
+void
+sup_pt_clear_pinned (const void *);
+
+bool
+sup_pt_fork (struct thread *);
+
+bool
+sup_pt_break_cow (struct page_struct *);
+
+uint8_t *
+frame_get_page (void);
+
 uint8_t *
 sup_pt_evict_frame (void);
 
+uint8_t *
+sup_pt_try_evict_frame (void);
+
+uint8_t *
+sup_pt_evict_lent (void);
+
 bool
 mark_page (void *, uint8_t *, size_t, uint32_t, block_sector_t);
 
@@ -110,4 +196,16 @@ mark_shared_page (void *, struct frame_struct *);
 struct frame_struct*
 frame_lookup_exec (block_sector_t, uint32_t);
 
+void
+frame_exec_invalidate (block_sector_t, size_t);
+
+void
+frame_rss_init (size_t);
+
+void
+frame_merge_scan (size_t);
+
+void
+frame_print_stats (void);
+
 #endif /* vm/frame.h */
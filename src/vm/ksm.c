@@ -0,0 +1,34 @@
+#include <debug.h>
+#include "ksm.h"
+#include "frame.h"
+#include "devices/timer.h"
+#include "threads/thread.h"
+
+/* The merge daemon looks for identical anonymous pages in the
+   background and shares them, see frame_merge_scan ().  It scans
+   a few pages at a time and sleeps in between, so it takes little
+   of the time of the processes whose pages it merges */
+static size_t ksm_pages;
+
+static thread_func ksm_daemon NO_RETURN;
+
+/* Start the merge daemon, scanning PAGES frames each time it wakes
+   up.  PAGES of 0 leaves every page to its own frame */
+void
+ksm_init (size_t pages)
+{
+  ksm_pages = pages;
+  if (ksm_pages > 0)
+    thread_create ("ksmd", PRI_DEFAULT, ksm_daemon, NULL);
+}
+
+/* Scan ksm_pages frames every KSM_INTERVAL ticks */
+static void
+ksm_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      frame_merge_scan (ksm_pages);
+      timer_sleep (KSM_INTERVAL);
+    }
+}
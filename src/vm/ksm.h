@@ -0,0 +1,15 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+#include <stddef.h>
+
+/* Default number of pages the merge daemon scans each time it
+   wakes up, 0 for no merging, see ksm_init () */
+#define KSM_PAGES_DEFAULT	0
+
+/* Timer ticks the merge daemon sleeps between scans */
+#define KSM_INTERVAL		10
+
+void ksm_init (size_t pages);
+
+#endif /* vm/ksm.h */
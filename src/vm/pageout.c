@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <debug.h>
+#include "pageout.h"
+#include "frame.h"
+#include "threads/thread.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "devices/timer.h"
+
+/* The pageout daemon keeps the number of free user pages between
+   two watermarks.  Once it drops below pageout_low, the daemon
+   evicts frames until pageout_high pages are free again, so most
+   page faults find a free frame and only have to read their page.
+   The daemon also evicts the frames in pages the kernel pool lent
+   to user pages once the kernel pool runs short, so the kernel
+   pool gets them back, see palloc_kernel_short () */
+static size_t pageout_low;
+static size_t pageout_high;
+
+/* Up'd to wake the daemon up */
+static struct semaphore pageout_wake;
+
+/* True while the daemon is awake */
+static volatile bool pageout_running;
+
+/* True once the daemon is started */
+static bool pageout_started;
+
+/* Once the daemon finds no lent page it can give back, the kernel
+   pool running short does not wake it again before lent_retry,
+   LENT_RETRY_TICKS later, so kernel allocations do not each cost
+   a scan of the frame table */
+#define LENT_RETRY_TICKS (TIMER_FREQ / 10)
+static int64_t lent_retry;
+
+/* Statistics */
+static long long wakeup_cnt;            /* # of times woken up */
+static long long pageout_cnt;           /* # of frames evicted */
+
+static thread_func pageout_daemon NO_RETURN;
+
+/* Start the pageout daemon with free user page watermarks LOW and
+   HIGH, clamped to the size of the user pool.  A LOW of 0 leaves
+   all eviction of user pages to the faulting processes */
+void
+pageout_init (size_t low, size_t high)
+{
+  size_t page_cnt = palloc_user_page_cnt ();
+
+  if (high > page_cnt / 2)
+    high = page_cnt / 2;
+  if (low > high)
+    low = high;
+  pageout_low = low;
+  pageout_high = high;
+
+  sema_init (&pageout_wake, 0);
+  pageout_running = false;
+  wakeup_cnt = pageout_cnt = 0;
+
+  if (thread_create ("pageout", PRI_DEFAULT, pageout_daemon, NULL)
+      != TID_ERROR)
+    pageout_started = true;
+}
+
+/* Wake the daemon up if free user pages ran below the low
+   watermark, called after taking a page from the user pool, or if
+   the kernel pool wants its lent pages back, called after taking
+   a page from the kernel pool */
+void
+pageout_check (void)
+{
+  if (!pageout_started || pageout_running)
+    return;
+  if ((pageout_low > 0 && palloc_user_free_cnt () < pageout_low)
+      || (palloc_kernel_short () && timer_ticks () >= lent_retry))
+    {
+      pageout_running = true;
+      sema_up (&pageout_wake);
+    }
+}
+
+/* Whether free user pages ran below the high watermark, so the
+   daemon is or soon will be evicting */
+bool
+pageout_short (void)
+{
+  return palloc_user_free_cnt () < pageout_high;
+}
+
+/* Print pageout daemon statistics */
+void
+pageout_print_stats (void)
+{
+  printf ("Pageout: %lld wakeups, %lld frames evicted\n",
+          wakeup_cnt, pageout_cnt);
+}
+
+/* Give the kernel pool back its lent pages, and evict frames in
+   the background until the high watermark is reached, then sleep
+   until pageout_check () calls again */
+static void
+pageout_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&pageout_wake);
+      wakeup_cnt++;
+
+      while (palloc_kernel_short ())
+        {
+          uint8_t *kpage = sup_pt_evict_lent ();
+          if (kpage == NULL)
+            {
+              lent_retry = timer_ticks () + LENT_RETRY_TICKS;
+              break;
+            }
+          palloc_free_page (kpage);
+          pageout_cnt++;
+        }
+
+      while (pageout_low > 0 && palloc_user_free_cnt () < pageout_high)
+        {
+          /* Every frame is busy or pinned, wait for the next call
+             instead of spinning */
+          uint8_t *kpage = sup_pt_try_evict_frame ();
+          if (kpage == NULL)
+            break;
+          palloc_free_page (kpage);
+          pageout_cnt++;
+        }
+      pageout_running = false;
+    }
+}
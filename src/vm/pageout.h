@@ -0,0 +1,16 @@
+#ifndef VM_PAGEOUT_H
+#define VM_PAGEOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Default free user page watermarks, see pageout_init () */
+#define PAGEOUT_LOW_DEFAULT	8
+#define PAGEOUT_HIGH_DEFAULT	16
+
+void pageout_init (size_t low, size_t high);
+void pageout_check (void);
+bool pageout_short (void);
+void pageout_print_stats (void);
+
+#endif /* vm/pageout.h */
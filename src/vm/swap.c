@@ -1,50 +1,275 @@
 #include <string.h>
 #include <bitmap.h>
+#include <hash.h>
+#include <lz.h>
 #include <stdio.h>
 #include <debug.h>
+#include <round.h>
 #include "swap.h"
 #include "frame.h"
+#include "pageout.h"
+#include "vma.h"
 #include "devices/block.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "threads/malloc.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "filesys/free-map.h"
 #include "userprog/pagedir.h"
+#include "user/syscall.h"
+
+/* Bounds of the read-ahead window, in pages */
+#define RA_WINDOW_MIN 2
+#define RA_WINDOW_MAX 16
+
+/* Swap space is managed in page sized slots */
+#define SLOT_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Slots are handed out from clusters of adjacent slots, so pages
+   evicted one after another land next to each other on disk */
+#define CLUSTER_SLOTS 16
 
 /* Point to device swap */
 struct block *sp_device;
-static struct bitmap *swap_free_map;
 struct lock swap_set_lock;
 
+/* Swap table, protected by swap_set_lock */
+static struct bitmap *swap_slot_map;    /* Used slots */
+static uint8_t *cluster_free;           /* # of free slots per cluster */
+static size_t cluster_cnt;
+static size_t next_slot;                /* Next slot to hand out */
+static size_t cluster_end;              /* End of next_slot's cluster */
+static size_t cluster_cursor;           /* Next cluster to look at */
+
+/* Compressed swap cache.  Pages written to swap are compressed
+   into a log in kernel pool memory instead, and only written to
+   their swap slot when they are the oldest in the log and room is
+   needed for a newer one.  Reading a page back, or freeing its
+   slot, leaves a hole reclaimed once the log's tail gets to it.
+   The oldest page is taken out of the log under zcache_lock, but
+   written to its slot with only zcache_spill_lock held, which
+   serializes stores, so the log stays usable meanwhile.  Who
+   needs the slot being written waits on zcache_spill_lock */
+struct zentry
+  {
+    struct hash_elem elem;      /* Element in zcache_index */
+    block_sector_t sector_no;   /* Swap slot of the page */
+    size_t size;                /* Bytes of compressed data */
+    bool live;                  /* False once read back or freed */
+    uint8_t data[];             /* Compressed data */
+  };
+
+/* Pages that do not compress to this size go to swap directly */
+#define ZCACHE_MAX_SIZE (PGSIZE * 3 / 4)
+
+/* Log of compressed pages, protected by zcache_lock.  Entries go
+   from zcache_tail to zcache_head, wrapping around at zcache_wrap */
+static uint8_t *zcache;
+static size_t zcache_size;              /* Size of the log in bytes */
+static size_t zcache_head;              /* Where the next entry goes */
+static size_t zcache_tail;              /* Oldest entry */
+static size_t zcache_wrap;              /* End of entries before head */
+static size_t zcache_used;              /* Bytes taken by entries */
+static struct hash zcache_index;        /* Live entries by sector */
+static struct lock zcache_lock;
+static struct lock zcache_spill_lock;
+static block_sector_t zcache_spill_sector; /* Slot being written, or
+                                              SECTOR_ERROR */
+static uint8_t zcache_buf[PGSIZE];      /* Compression scratch */
+static uint8_t zcache_spill_buf[PGSIZE]; /* Page being written */
+static uint8_t zcache_work[LZ_WORK_SIZE];
+
+/* Statistics */
+static long long zcache_store_cnt;      /* # of pages stored */
+static long long zcache_reject_cnt;     /* # of pages not compressible */
+static long long zcache_hit_cnt;        /* # of pages read from the log */
+static long long zcache_spill_cnt;      /* # of pages written to swap */
+static long long zcache_in_bytes;       /* Bytes stored before ... */
+static long long zcache_out_bytes;      /* ... and after compression */
+
+static block_sector_t swap_slot_alloc (void);
+static void swap_slot_free (block_sector_t);
+static bool swap_next_cluster (bool);
+static size_t cluster_size (size_t);
+static bool swap_cache_store (block_sector_t, const void *);
+static bool swap_cache_load (block_sector_t, void *);
+static bool swap_cache_holds (block_sector_t);
+static void swap_cache_forget (const block_sector_t *, size_t);
+static void swap_drop_behind (struct vma *, void *);
+static struct zentry *zcache_alloc (size_t);
+static bool zcache_pop (void);
+static size_t zentry_size (const struct zentry *);
+static struct zentry *zcache_find (block_sector_t);
+static hash_hash_func zcache_hash;
+static hash_less_func zcache_less;
+
 /* Initialize swap device and swap table */
 bool swap_init ()
 {  
+  size_t i;
+
   sp_device = block_get_role (BLOCK_SWAP);
   lock_init (&swap_set_lock);
   /* Bitmap for swap */
-  swap_free_map = bitmap_create (block_size (sp_device));
-  if (swap_free_map == NULL)
+  swap_slot_map = bitmap_create (block_size (sp_device) / SLOT_SECTORS);
+  if (swap_slot_map == NULL)
   {
      return false;
   }
+
+  cluster_cnt = DIV_ROUND_UP (bitmap_size (swap_slot_map), CLUSTER_SLOTS);
+  cluster_free = malloc (cluster_cnt);
+  if (cluster_free == NULL)
+    return false;
+  for (i = 0; i < cluster_cnt; i++)
+    cluster_free[i] = cluster_size (i);
+  next_slot = cluster_end = 0;
+  cluster_cursor = 0;
+
+  lock_init (&zcache_lock);
+  lock_init (&zcache_spill_lock);
+  zcache_spill_sector = SECTOR_ERROR;
+  hash_init (&zcache_index, zcache_hash, zcache_less, NULL);
   return true;
 }
 
+/* Set aside PAGE_CNT kernel pages for the compressed swap cache,
+   0 disables it */
+void
+swap_cache_init (size_t page_cnt)
+{
+  if (page_cnt == 0)
+    return;
+  zcache = palloc_get_multiple (0, page_cnt);
+  if (zcache == NULL)
+    PANIC ("Cannot allocate %zu pages for the swap cache", page_cnt);
+  zcache_size = page_cnt * PGSIZE;
+  zcache_head = zcache_tail = zcache_used = 0;
+  zcache_wrap = zcache_size;
+}
+
+/* Print swap statistics */
+void
+swap_print_stats (void)
+{
+  printf ("Swap cache: %lld stored, %lld rejected, %lld hits, "
+          "%lld spilled, %lld%% compressed size\n",
+          zcache_store_cnt, zcache_reject_cnt, zcache_hit_cnt,
+          zcache_spill_cnt,
+          zcache_in_bytes ? zcache_out_bytes * 100 / zcache_in_bytes : 0);
+}
+
+/* Allocate a swap slot, return its first sector,
+   or SECTOR_ERROR if swap is full */
+static block_sector_t
+swap_slot_alloc (void)
+{
+  size_t slot;
+
+  lock_acquire (&swap_set_lock);
+  for (;;)
+    {
+      while (next_slot < cluster_end && bitmap_test (swap_slot_map, next_slot))
+        next_slot++;
+      if (next_slot < cluster_end)
+        break;
+
+      /* Move on to the next free cluster, or at least the next
+         cluster with any free slot */
+      if (!swap_next_cluster (true) && !swap_next_cluster (false))
+        {
+          lock_release (&swap_set_lock);
+          return SECTOR_ERROR;
+        }
+    }
+
+  slot = next_slot++;
+  bitmap_mark (swap_slot_map, slot);
+  cluster_free[slot / CLUSTER_SLOTS]--;
+  lock_release (&swap_set_lock);
+
+  return slot * SLOT_SECTORS;
+}
+
+/* Free the swap slot starting at SECTOR_NO */
+static void
+swap_slot_free (block_sector_t sector_no)
+{
+  swap_release (&sector_no, 1);
+}
+
+/* Free the CNT swap slots starting at the sectors in SECTORS,
+   taking the locks once for all of them */
+void
+swap_release (const block_sector_t *sectors, size_t cnt)
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+
+  swap_cache_forget (sectors, cnt);
+  lock_acquire (&swap_set_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      size_t slot = sectors[i] / SLOT_SECTORS;
+      ASSERT (bitmap_test (swap_slot_map, slot));
+      bitmap_reset (swap_slot_map, slot);
+      cluster_free[slot / CLUSTER_SLOTS]++;
+    }
+  lock_release (&swap_set_lock);
+}
+
+/* Point next_slot at the cluster following cluster_cursor, in a
+   circular way, that is completely free if WHOLE, or has any free
+   slot otherwise.  Return false if there is no such cluster */
+static bool
+swap_next_cluster (bool whole)
+{
+  size_t i;
+
+  for (i = 0; i < cluster_cnt; i++)
+    {
+      size_t cluster = (cluster_cursor + i) % cluster_cnt;
+      if (whole ? cluster_free[cluster] == cluster_size (cluster)
+                : cluster_free[cluster] > 0)
+        {
+          next_slot = cluster * CLUSTER_SLOTS;
+          cluster_end = next_slot + cluster_size (cluster);
+          cluster_cursor = (cluster + 1) % cluster_cnt;
+          return true;
+        }
+    }
+  return false;
+}
+
+/* Number of slots in CLUSTER, the last one may be short */
+static size_t
+cluster_size (size_t cluster)
+{
+  size_t slot_cnt = bitmap_size (swap_slot_map);
+  size_t start = cluster * CLUSTER_SLOTS;
+  return slot_cnt - start < CLUSTER_SLOTS ? slot_cnt - start : CLUSTER_SLOTS;
+}
+
 void swap_free (uint32_t * pte)
 {
    
+   /* A zero page on swap was never written out, and owns no slot.
+      The slot of a frame shared after fork () goes with its last pte */
    struct page_struct * ps = sup_pt_ps_lookup (pte);   
-   if (ps != NULL && (ps->fs->flag&POSBITS) == POS_SWAP )
-   {  
-      lock_acquire (&swap_set_lock);
-      bitmap_set_multiple (swap_free_map, ps->fs->sector_no, 
- 			PGSIZE / BLOCK_SECTOR_SIZE, false);
-      lock_release (&swap_set_lock);
-   }
-   return;
+   if (ps == NULL)
+     return;
+
+   struct frame_struct *fs = sup_pt_lock_frame (ps);
+   if ((fs->flag&POSBITS) == POS_SWAP && (fs->flag & FS_ZERO) == 0
+       && fs->pte_cnt == 1)
+     swap_slot_free (fs->sector_no);
+   lock_release (&fs->frame_lock);
 }
 
 /* Swap in a page on disk or on swap space, or initilize a zero page*/
@@ -57,17 +282,9 @@ bool swap_in (struct frame_struct *pframe)
   uint32_t is_all_zero = pframe->flag & FS_ZERO;
 
   /* Get a frame, from memory or by evict another frame */
-  uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-
+  uint8_t *kpage = frame_get_page ();
   if (kpage == NULL)
-  {
-    /* Evict to get a frame */
-    kpage = sup_pt_evict_frame ();
-    if (kpage == NULL)
-    {
-      return false;
-    }
-  }
+    return false;
    
   /* If zero page, just write a page of 0's */
   if (is_all_zero)
@@ -100,22 +317,25 @@ bool swap_in (struct frame_struct *pframe)
     return false;
   }
 
-  if (device == fs_device)
-    lock_acquire (&glb_lock_filesys);
-  else 
-    lock_acquire (&glb_lock_swapsys);
-
-  /* Read from disk or swap */
-  block_sector_t i;
-  for (i = 0; i < PGSIZE / BLOCK_SECTOR_SIZE; i++)
+  /* Read from disk or swap, the whole page in one transfer.
+     Only the sectors holding file data are read from disk */
+  if (device == fs_device || !swap_cache_load (sector_no, kpage))
   {
-    block_read (device, sector_no + i, kpage + BLOCK_SECTOR_SIZE * i); 
-  }
+    if (device == fs_device)
+      lock_acquire (&glb_lock_filesys);
+    else 
+      lock_acquire (&glb_lock_swapsys);
 
-  if (device == fs_device)
-    lock_release (&glb_lock_filesys);
-  else 
-    lock_release (&glb_lock_swapsys);  
+    block_sector_t sector_cnt = PGSIZE / BLOCK_SECTOR_SIZE;
+    if (device == fs_device)
+      sector_cnt = DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE);
+    block_read_multiple (device, sector_no, sector_cnt, kpage);
+
+    if (device == fs_device)
+      lock_release (&glb_lock_filesys);
+    else 
+      lock_release (&glb_lock_swapsys);  
+  }
 
   /* Set remaining of the page to 0, only necessary for disk */
   if ((length < PGSIZE) && (device == fs_device))
@@ -123,18 +343,232 @@ bool swap_in (struct frame_struct *pframe)
   
   /* Free swap table entries */
   if (device == sp_device)
-   {
-    lock_acquire (&swap_set_lock);
-    bitmap_set_multiple (swap_free_map, sector_no,
-			   PGSIZE / BLOCK_SECTOR_SIZE, false);
-    lock_release (&swap_set_lock);
-   }
+    swap_slot_free (sector_no);
 
   /* Update sup_pt entry information */
   sup_pt_set_swap_in (pframe, kpage);
   return true;
 }
 
+/* Read ahead the pages following UPAGE, whose fault was just
+   served from disk, or from swap if FROM_SWAP.  Faults that follow
+   each other through a mapping double the read-ahead window, up to
+   RA_WINDOW_MAX, other faults halve it.  The window is filled with
+   pages on the same device whose sectors continue those of UPAGE,
+   read by a single transfer into free frames, which for swap are
+   the slots the pages were evicted to one after another.
+   Read-ahead stops at the first page that does not qualify, is
+   pinned, is busy, or for swap is held by the compressed swap
+   cache, and never evicts a frame.  Areas advised MADV_RANDOM get
+   no read-ahead, MADV_SEQUENTIAL ones get the whole window at
+   once, and the pages they left behind are reclaimed first */
+void
+swap_in_around (void *upage, bool from_swap)
+{
+  struct thread *t = thread_current ();
+  struct frame_struct *batch[RA_WINDOW_MAX];
+  block_sector_t slots[RA_WINDOW_MAX];
+  struct frame_struct *prev;
+  uint32_t pos = from_swap ? POS_SWAP : POS_DISK;
+  struct page_struct *ps;
+  struct vma *vma = vma_find (upage);
+  int advice = vma != NULL ? vma->advice : MADV_NORMAL;
+  size_t cnt, i;
+
+  if (advice == MADV_RANDOM)
+    return;
+
+  /* Adapt the window to the access pattern */
+  if (advice == MADV_SEQUENTIAL)
+    {
+      t->ra_window = RA_WINDOW_MAX;
+      swap_drop_behind (vma, upage);
+    }
+  else if (upage == t->ra_next)
+    t->ra_window = t->ra_window == 0 ? RA_WINDOW_MIN
+                   : t->ra_window * 2 > RA_WINDOW_MAX ? RA_WINDOW_MAX
+                   : t->ra_window * 2;
+  else
+    t->ra_window /= 2;
+  t->ra_next = upage + PGSIZE;
+
+  ps = sup_pt_ps_lookup (sup_pt_pte_lookup (t->pagedir, upage, false));
+  if (ps == NULL)
+    return;
+
+  /* Collect the window, locking each frame */
+  prev = ps->fs;
+  for (cnt = 0; cnt < t->ra_window; cnt++)
+    {
+      void *next = upage + (cnt + 1) * PGSIZE;
+      uint32_t *pte;
+      struct frame_struct *fs;
+
+      if (!is_user_vaddr (next))
+        break;
+
+      /* Start tracking pages of the area not faulted in yet */
+      pte = sup_pt_pte_lookup (t->pagedir, next, false);
+      ps = pte != NULL ? sup_pt_ps_lookup (pte) : NULL;
+      if (ps == NULL)
+        {
+          if (from_swap || !vma_track_page (next))
+            break;
+          pte = sup_pt_pte_lookup (t->pagedir, next, false);
+          if (pte == NULL || (ps = sup_pt_ps_lookup (pte)) == NULL)
+            break;
+        }
+
+      /* A short page ends the run of file data */
+      fs = ps->fs;
+      if ((!from_swap && prev->length < PGSIZE)
+          || !lock_try_acquire (&fs->frame_lock))
+        break;
+      if (ps->fs != fs
+          || (fs->flag & POSBITS) != pos
+          || (fs->flag & (FS_ZERO | FS_PINNED)) != 0
+          || (!from_swap
+              && (fs->flag & TYPEBITS) != (prev->flag & TYPEBITS))
+          || fs->sector_no != prev->sector_no + SLOT_SECTORS
+          || (from_swap && swap_cache_holds (fs->sector_no)))
+        {
+          lock_release (&fs->frame_lock);
+          break;
+        }
+      fs->flag |= FS_PINNED;
+      batch[cnt] = prev = fs;
+    }
+
+  /* Get contiguous free frames for as much of the window as
+     possible, so it is read in one transfer */
+  uint8_t *kpages = NULL;
+  size_t read_cnt = cnt;
+  while (read_cnt > 0
+         && (kpages = palloc_get_multiple (PAL_USER, read_cnt)) == NULL)
+    read_cnt /= 2;
+
+  if (read_cnt > 0 && from_swap)
+    {
+      lock_acquire (&glb_lock_swapsys);
+      block_read_multiple (sp_device, batch[0]->sector_no,
+                           read_cnt * SLOT_SECTORS, kpages);
+      lock_release (&glb_lock_swapsys);
+
+      for (i = 0; i < read_cnt; i++)
+        {
+          slots[i] = batch[i]->sector_no;
+          sup_pt_set_swap_in (batch[i], kpages + i * PGSIZE);
+        }
+      swap_release (slots, read_cnt);
+      t->ra_next = upage + (read_cnt + 1) * PGSIZE;
+    }
+  else if (read_cnt > 0)
+    {
+      block_sector_t sector_cnt = (read_cnt - 1) * SLOT_SECTORS
+        + DIV_ROUND_UP (batch[read_cnt - 1]->length, BLOCK_SECTOR_SIZE);
+
+      lock_acquire (&glb_lock_filesys);
+      block_read_multiple (fs_device, batch[0]->sector_no, sector_cnt, kpages);
+      lock_release (&glb_lock_filesys);
+
+      for (i = 0; i < read_cnt; i++)
+        {
+          uint8_t *kpage = kpages + i * PGSIZE;
+          struct frame_struct *fs = batch[i];
+
+          if (fs->length < PGSIZE)
+            memset (kpage + fs->length, 0, PGSIZE - fs->length);
+          fs->flag &= ~FS_DIRTY;
+          sup_pt_set_swap_in (fs, kpage);
+        }
+      t->ra_next = upage + (read_cnt + 1) * PGSIZE;
+    }
+
+  /* Unlock the window, including the pages left out */
+  for (i = 0; i < cnt; i++)
+    {
+      batch[i]->flag &= ~FS_PINNED;
+      lock_release (&batch[i]->frame_lock);
+    }
+  pageout_check ();
+}
+
+/* Clear the accessed bits of the pages of VMA a window behind
+   UPAGE, which a sequential scan is done with, so they are evicted
+   before pages still in use.  The window right behind UPAGE is
+   left alone, in case the scan is not strictly in order */
+static void
+swap_drop_behind (struct vma *vma, void *upage)
+{
+  struct thread *t = thread_current ();
+  size_t behind = (upage - vma->start) / PGSIZE;
+  void *start, *end, *p;
+
+  if (behind <= RA_WINDOW_MAX)
+    return;
+  end = upage - RA_WINDOW_MAX * PGSIZE;
+  start = behind > 2 * RA_WINDOW_MAX ? end - RA_WINDOW_MAX * PGSIZE
+                                     : vma->start;
+
+  for (p = start; p < end; p += PGSIZE)
+    {
+      uint32_t *pte = sup_pt_pte_lookup (t->pagedir, p, false);
+      struct page_struct *ps;
+      struct frame_struct *fs;
+
+      if (pte == NULL || (*pte & PTE_P) == 0
+          || (ps = sup_pt_ps_lookup (pte)) == NULL)
+        continue;
+      fs = ps->fs;
+      if (!lock_try_acquire (&fs->frame_lock))
+        continue;
+      if (ps->fs == fs && (fs->flag & FS_PINNED) == 0)
+        sup_pt_fs_deactivate (fs);
+      lock_release (&fs->frame_lock);
+    }
+}
+
+/* Bring UPAGE of the current process in ahead of its first use if
+   it is on disk or on swap, for MADV_WILLNEED.  Only free frames
+   are used, another frame is never evicted for it.  Return false
+   once the user pool ran out of free frames */
+bool
+swap_prefetch (void *upage)
+{
+  struct thread *t = thread_current ();
+  struct page_struct *ps;
+  struct frame_struct *fs;
+  uint32_t *pte;
+  uint32_t pos;
+
+  if (palloc_user_free_cnt () == 0)
+    return false;
+
+  pte = sup_pt_pte_lookup (t->pagedir, upage, false);
+  ps = pte != NULL ? sup_pt_ps_lookup (pte) : NULL;
+  if (ps == NULL)
+    {
+      if (!vma_track_page (upage))
+        return true;
+      pte = sup_pt_pte_lookup (t->pagedir, upage, false);
+      if (pte == NULL || (ps = sup_pt_ps_lookup (pte)) == NULL)
+        return true;
+    }
+
+  /* Zero pages cost nothing to bring in on their fault */
+  fs = sup_pt_lock_frame (ps);
+  pos = fs->flag & POSBITS;
+  if ((pos == POS_DISK || pos == POS_SWAP)
+      && (fs->flag & (FS_ZERO | FS_PINNED)) == 0)
+    {
+      fs->flag |= FS_PINNED;
+      swap_in (fs);
+      fs->flag &= ~FS_PINNED;
+    }
+  lock_release (&fs->frame_lock);
+  return true;
+}
+
 /* TODO need better comment swap out */
 bool swap_out (struct frame_struct *pframe)
 {  
@@ -155,7 +589,8 @@ bool swap_out (struct frame_struct *pframe)
   /* Zero and not dirty page need not swap out */
   if (is_all_zero && !dirty)
   {
-    pframe->flag = (pframe->flag & POSMASK) | POS_DISK;
+    sup_pt_set_swap_out (pframe, pframe->sector_no, true);
+    lock_release (&pframe->frame_lock);
     return true;
   }
   else 
@@ -166,10 +601,7 @@ bool swap_out (struct frame_struct *pframe)
   if (type == TYPE_Stack)
   {
     device = sp_device;
-    lock_acquire (&swap_set_lock);
-    sector_no = bitmap_scan_and_flip (swap_free_map, 0,
-                                      PGSIZE / BLOCK_SECTOR_SIZE, false);
-    lock_release (&swap_set_lock);
+    sector_no = swap_slot_alloc ();
     pos = POS_SWAP;
     goto write;
   }
@@ -197,10 +629,7 @@ bool swap_out (struct frame_struct *pframe)
     if (dirty)
     {
       device = sp_device;
-      lock_acquire (&swap_set_lock);
-      sector_no = bitmap_scan_and_flip (swap_free_map, 0,
-                                        PGSIZE / BLOCK_SECTOR_SIZE, false);
-      lock_release (&swap_set_lock);
+      sector_no = swap_slot_alloc ();
       goto write;
     } else
     {
@@ -211,6 +640,16 @@ bool swap_out (struct frame_struct *pframe)
   }
 
 write:
+  if (sector_no == SECTOR_ERROR)
+    PANIC ("Out of swap space");
+
+  /* Swap goes to the compressed cache first */
+  if (device == sp_device && swap_cache_store (sector_no, kpage))
+  {
+    sup_pt_set_swap_out (pframe, sector_no, false);
+    lock_release (&pframe->frame_lock);
+    return true;
+  }
 
   /* Write to disk or swap device */
   if (device == fs_device)
@@ -218,19 +657,287 @@ write:
   else 
     lock_acquire (&glb_lock_swapsys);
 
-  int i;
-  for (i = 0; i < PGSIZE / BLOCK_SECTOR_SIZE; i++)
-  {
-    block_write (device, sector_no + i, kpage + BLOCK_SECTOR_SIZE * i); 
-  }
+  /* The whole page in one transfer, but never past the end of
+     a memory mapped file's data */
+  block_sector_t sector_cnt = PGSIZE / BLOCK_SECTOR_SIZE;
+  if (device == fs_device)
+    sector_cnt = DIV_ROUND_UP (pframe->length, BLOCK_SECTOR_SIZE);
+  block_write_multiple (device, sector_no, sector_cnt, kpage);
 
   if (device == fs_device)
     lock_release (&glb_lock_filesys);
   else 
     lock_release (&glb_lock_swapsys);  
 
+  /* Writing a mapped file bypasses inode_write_at (), so drop the
+     pages of the exec page cache it made stale here */
+  if (device == fs_device)
+    frame_exec_invalidate (sector_no, sector_cnt);
+
   sup_pt_set_swap_out (pframe, sector_no, (pos == POS_DISK));
+
+  /* A memory mapped page just written back is clean */
+  if (pos == POS_DISK)
+    pframe->flag &= ~FS_DIRTY;
   lock_release (&pframe->frame_lock);	
   return true;
 }
 
+
+/* Compress the page at KPAGE into the swap cache as the content
+   of the swap slot at SECTOR_NO.  Returns false if the cache is
+   disabled or the page does not compress well enough, then the
+   caller writes it to the slot itself */
+static bool
+swap_cache_store (block_sector_t sector_no, const void *kpage)
+{
+  struct zentry *e;
+  size_t size;
+
+  if (zcache == NULL)
+    return false;
+
+  lock_acquire (&zcache_spill_lock);
+  size = lz_compress (kpage, PGSIZE, zcache_buf, ZCACHE_MAX_SIZE,
+                      zcache_work);
+  lock_acquire (&zcache_lock);
+  if (size == 0)
+    {
+      zcache_reject_cnt++;
+      lock_release (&zcache_lock);
+      lock_release (&zcache_spill_lock);
+      return false;
+    }
+
+  /* Write the pages making room to their slots one at a time,
+     without holding zcache_lock */
+  while ((e = zcache_alloc (sizeof *e + size)) == NULL
+         && zcache_spill_sector != SECTOR_ERROR)
+    {
+      lock_release (&zcache_lock);
+      lock_acquire (&glb_lock_swapsys);
+      block_write_multiple (sp_device, zcache_spill_sector, SLOT_SECTORS,
+                            zcache_spill_buf);
+      lock_release (&glb_lock_swapsys);
+      lock_acquire (&zcache_lock);
+      zcache_spill_sector = SECTOR_ERROR;
+    }
+  if (e == NULL)
+    {
+      lock_release (&zcache_lock);
+      lock_release (&zcache_spill_lock);
+      return false;
+    }
+  e->sector_no = sector_no;
+  e->size = size;
+  e->live = true;
+  memcpy (e->data, zcache_buf, size);
+  hash_insert (&zcache_index, &e->elem);
+
+  zcache_store_cnt++;
+  zcache_in_bytes += PGSIZE;
+  zcache_out_bytes += size;
+  lock_release (&zcache_lock);
+  lock_release (&zcache_spill_lock);
+  return true;
+}
+
+/* Read the content of the swap slot at SECTOR_NO into KPAGE if
+   it is in the swap cache, and drop it from the cache */
+static bool
+swap_cache_load (block_sector_t sector_no, void *kpage)
+{
+  struct zentry *e;
+  bool spilling;
+  bool success;
+
+  if (zcache == NULL)
+    return false;
+
+  lock_acquire (&zcache_lock);
+  e = zcache_find (sector_no);
+  spilling = e == NULL && zcache_spill_sector == sector_no;
+  if (e != NULL)
+    {
+      success = lz_decompress (e->data, e->size, kpage, PGSIZE);
+      ASSERT (success);
+      hash_delete (&zcache_index, &e->elem);
+      e->live = false;
+      zcache_hit_cnt++;
+    }
+  lock_release (&zcache_lock);
+
+  /* On its way to the slot, to be read from there once written */
+  if (spilling)
+    {
+      lock_acquire (&zcache_spill_lock);
+      lock_release (&zcache_spill_lock);
+    }
+  return e != NULL;
+}
+
+/* Whether the swap cache holds the content of the swap slot at
+   SECTOR_NO, rather than the slot itself, including while it is
+   being written there */
+static bool
+swap_cache_holds (block_sector_t sector_no)
+{
+  bool holds;
+
+  if (zcache == NULL)
+    return false;
+  lock_acquire (&zcache_lock);
+  holds = zcache_find (sector_no) != NULL
+          || zcache_spill_sector == sector_no;
+  lock_release (&zcache_lock);
+  return holds;
+}
+
+/* Drop the CNT swap slots at SECTORS from the swap cache, and
+   reclaim the holes at the tail of the log.  A slot being written
+   is waited for, so it is not handed out again meanwhile */
+static void
+swap_cache_forget (const block_sector_t *sectors, size_t cnt)
+{
+  bool spilling = false;
+  size_t i;
+
+  if (zcache == NULL)
+    return;
+
+  lock_acquire (&zcache_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct zentry *e = zcache_find (sectors[i]);
+      if (e != NULL)
+        {
+          hash_delete (&zcache_index, &e->elem);
+          e->live = false;
+        }
+      else if (sectors[i] == zcache_spill_sector)
+        spilling = true;
+    }
+  while (zcache_used > 0 && !((struct zentry *) (zcache + zcache_tail))->live)
+    zcache_pop ();
+  lock_release (&zcache_lock);
+
+  if (spilling)
+    {
+      lock_acquire (&zcache_spill_lock);
+      lock_release (&zcache_spill_lock);
+    }
+}
+
+/* Make room for an entry of SIZE bytes at the head of the log,
+   dropping the oldest entries as needed.  Return NULL if SIZE is
+   too big, or once a live entry was dropped, whose page the caller
+   must write to zcache_spill_sector first */
+static struct zentry *
+zcache_alloc (size_t size)
+{
+  size = ROUND_UP (size, sizeof (void *));
+  if (size > zcache_size)
+    return NULL;
+
+  for (;;)
+    {
+      struct zentry *e = NULL;
+
+      if (zcache_used == 0)
+        {
+          zcache_head = zcache_tail = 0;
+          zcache_wrap = zcache_size;
+        }
+
+      if (zcache_head < zcache_tail
+          || (zcache_head == zcache_tail && zcache_used > 0))
+        {
+          /* Wrapped around, room up to the tail */
+          if (zcache_tail - zcache_head >= size)
+            e = (struct zentry *) (zcache + zcache_head);
+        }
+      else if (zcache_size - zcache_head >= size)
+        e = (struct zentry *) (zcache + zcache_head);
+      else if (zcache_tail >= size)
+        {
+          /* Wrap around, leaving the end of the log unused */
+          zcache_wrap = zcache_head;
+          zcache_head = 0;
+          e = (struct zentry *) zcache;
+        }
+
+      if (e != NULL)
+        {
+          zcache_head += size;
+          zcache_used += size;
+          return e;
+        }
+      if (zcache_pop ())
+        return NULL;
+    }
+}
+
+/* Remove the oldest entry of the log.  If it is still live, its
+   page goes to zcache_spill_buf, to be written to
+   zcache_spill_sector by the caller, and true is returned */
+static bool
+zcache_pop (void)
+{
+  struct zentry *e = (struct zentry *) (zcache + zcache_tail);
+  bool live = e->live;
+  bool success;
+
+  ASSERT (zcache_used > 0);
+
+  if (live)
+    {
+      ASSERT (zcache_spill_sector == SECTOR_ERROR);
+      success = lz_decompress (e->data, e->size, zcache_spill_buf, PGSIZE);
+      ASSERT (success);
+      zcache_spill_sector = e->sector_no;
+      hash_delete (&zcache_index, &e->elem);
+      zcache_spill_cnt++;
+    }
+
+  zcache_tail += zentry_size (e);
+  zcache_used -= zentry_size (e);
+  if (zcache_tail == zcache_wrap)
+    {
+      zcache_tail = 0;
+      zcache_wrap = zcache_size;
+    }
+  return live;
+}
+
+/* Bytes of the log taken by E */
+static size_t
+zentry_size (const struct zentry *e)
+{
+  return ROUND_UP (sizeof *e + e->size, sizeof (void *));
+}
+
+/* Find the live entry for the swap slot at SECTOR_NO */
+static struct zentry *
+zcache_find (block_sector_t sector_no)
+{
+  struct zentry key;
+  struct hash_elem *elem;
+
+  key.sector_no = sector_no;
+  elem = hash_find (&zcache_index, &key.elem);
+  return elem != NULL ? hash_entry (elem, struct zentry, elem) : NULL;
+}
+
+static unsigned
+zcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct zentry, elem)->sector_no);
+}
+
+static bool
+zcache_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED)
+{
+  return hash_entry (a, struct zentry, elem)->sector_no
+         < hash_entry (b, struct zentry, elem)->sector_no;
+}
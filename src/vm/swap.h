@@ -5,9 +5,17 @@
 #include <stdint.h>
 #include "frame.h"
 
+/* Default size of the compressed swap cache, in pages */
+#define SWAP_CACHE_DEFAULT	32
+
 bool swap_init (void);
+void swap_cache_init (size_t page_cnt);
+void swap_print_stats (void);
 bool swap_in (struct frame_struct *pframe);
 bool swap_out (struct frame_struct *pframe);
+void swap_in_around (void *upage, bool from_swap);
+bool swap_prefetch (void *upage);
 void swap_free (uint32_t * pte);
+void swap_release (const block_sector_t *sectors, size_t cnt);
 
 #endif /* vm/swap.h */
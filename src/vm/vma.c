@@ -0,0 +1,207 @@
+#include <debug.h>
+#include <round.h>
+#include "vma.h"
+#include "frame.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "filesys/inode.h"
+#include "user/syscall.h"
+
+static struct vma *vma_insert (struct thread *, void *, void *,
+                               struct inode *, off_t, size_t, uint32_t);
+static void vma_free (struct vma *);
+
+/* Map SIZE bytes from user page START of the current process to
+   FILE from OFFSET on, the first READ_BYTES bytes of which come
+   from the file and the rest are zero.  Pages get the type and
+   property bits of FLAG.  The area keeps its own reference to the
+   file's inode.  Returns NULL if out of memory */
+struct vma *
+vma_add (void *start, size_t size, struct file *file, off_t offset,
+         size_t read_bytes, uint32_t flag)
+{
+  ASSERT (pg_ofs (start) == 0);
+  ASSERT (offset % PGSIZE == 0);
+  ASSERT (read_bytes <= size);
+
+  return vma_insert (thread_current (), start,
+                     start + ROUND_UP (size, PGSIZE),
+                     inode_reopen (file_get_inode (file)),
+                     offset, read_bytes, flag);
+}
+
+/* Remove VMA from the current process.  Its pages that were
+   faulted in are left to the caller */
+void
+vma_remove (struct vma *vma)
+{
+  list_remove (&vma->elem);
+  vma_free (vma);
+}
+
+/* Remove all areas of the current process */
+void
+vma_destroy (void)
+{
+  struct thread *t = thread_current ();
+
+  while (!list_empty (&t->vma_list))
+    vma_remove (list_entry (list_front (&t->vma_list), struct vma, elem));
+}
+
+/* Copy the areas of PARENT into the current process, called
+   while PARENT waits for the fork to complete.  Memory mappings
+   are not inherited, so their areas are left out */
+bool
+vma_fork (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->vma_list); e != list_end (&parent->vma_list);
+       e = list_next (e))
+    {
+      struct vma *vma = list_entry (e, struct vma, elem);
+      struct vma *copy;
+
+      if ((vma->flag & TYPEBITS) == TYPE_MMFile)
+        continue;
+      copy = vma_insert (t, vma->start, vma->end, inode_reopen (vma->inode),
+                         vma->offset, vma->read_bytes, vma->flag);
+      if (copy == NULL)
+        return false;
+      copy->advice = vma->advice;
+    }
+  return true;
+}
+
+/* Find the area of the current process containing ADDR */
+struct vma *
+vma_find (const void *addr)
+{
+  struct thread *t = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&t->vma_list); e != list_end (&t->vma_list);
+       e = list_next (e))
+    {
+      struct vma *vma = list_entry (e, struct vma, elem);
+      if (addr >= vma->start && addr < vma->end)
+        return vma;
+    }
+  return NULL;
+}
+
+/* Whether SIZE bytes from START overlap an area of the current
+   process */
+bool
+vma_overlaps (const void *start, size_t size)
+{
+  struct thread *t = thread_current ();
+  const void *end = start + ROUND_UP (size, PGSIZE);
+  struct list_elem *e;
+
+  for (e = list_begin (&t->vma_list); e != list_end (&t->vma_list);
+       e = list_next (e))
+    {
+      struct vma *vma = list_entry (e, struct vma, elem);
+      if (start < vma->end && vma->start < end)
+        return true;
+    }
+  return false;
+}
+
+/* Set the access pattern of the areas of the current process
+   overlapping SIZE bytes from START to ADVICE, MADV_NORMAL,
+   MADV_RANDOM or MADV_SEQUENTIAL.  Areas are not split, advice
+   holds for all of an area */
+void
+vma_advise (const void *start, size_t size, int advice)
+{
+  struct thread *t = thread_current ();
+  const void *end = start + ROUND_UP (size, PGSIZE);
+  struct list_elem *e;
+
+  for (e = list_begin (&t->vma_list); e != list_end (&t->vma_list);
+       e = list_next (e))
+    {
+      struct vma *vma = list_entry (e, struct vma, elem);
+      if (start < vma->end && vma->start < end)
+        vma->advice = advice;
+    }
+}
+
+/* Start tracking UPAGE of the current process in the supplemental
+   page table, as not yet read from its area.  Executable pages
+   share a frame already holding the same sector.  Returns false
+   if UPAGE is in no area or out of memory */
+bool
+vma_track_page (void *upage)
+{
+  struct vma *vma = vma_find (upage);
+  struct frame_struct *fs;
+  size_t ofs, length;
+  block_sector_t sector_no;
+  uint32_t flag;
+
+  if (vma == NULL)
+    return false;
+
+  ofs = upage - vma->start;
+  length = ofs < vma->read_bytes ? vma->read_bytes - ofs : 0;
+  if (length > PGSIZE)
+    length = PGSIZE;
+
+  flag = POS_DISK | vma->flag;
+  if (length == 0)
+    {
+      flag |= FS_ZERO;
+      sector_no = SECTOR_ERROR;
+    }
+  else
+    {
+      sector_no = byte_to_sector (vma->inode, vma->offset + ofs);
+      fs = frame_lookup_exec (sector_no, flag);
+      if (fs != NULL)
+        return mark_shared_page (upage, fs);
+    }
+  return mark_page (upage, NULL, length, flag, sector_no);
+}
+
+/* Add an area from START to END to T */
+static struct vma *
+vma_insert (struct thread *t, void *start, void *end, struct inode *inode,
+            off_t offset, size_t read_bytes, uint32_t flag)
+{
+  struct vma *vma = malloc (sizeof *vma);
+  if (vma == NULL)
+    {
+      inode_close (inode);
+      return NULL;
+    }
+
+  vma->start = start;
+  vma->end = end;
+  vma->inode = inode;
+  vma->offset = offset;
+  vma->read_bytes = read_bytes;
+  vma->flag = flag;
+  vma->advice = MADV_NORMAL;
+  list_push_back (&t->vma_list, &vma->elem);
+  return vma;
+}
+
+/* Drop VMA's reference to its inode and free it */
+static void
+vma_free (struct vma *vma)
+{
+  bool holding_filesys_lock = lock_held_by_current_thread (&glb_lock_filesys);
+
+  if (!holding_filesys_lock)
+    lock_acquire (&glb_lock_filesys);
+  inode_close (vma->inode);
+  if (!holding_filesys_lock)
+    lock_release (&glb_lock_filesys);
+  free (vma);
+}
@@ -0,0 +1,55 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <list.h>
+#include "filesys/file.h"
+#include "filesys/off_t.h"
+
+struct thread;
+
+/* A virtual memory area is a run of user pages backed by a file,
+   an executable segment or a memory mapped file.  Its pages get a
+   page_struct and a frame_struct on their first fault, so mapping
+   costs the same whatever the size of the area */
+struct vma
+{
+  void *start;                  /* First user page */
+  void *end;                    /* Past the last user page */
+  struct inode *inode;          /* File the pages are read from */
+  off_t offset;                 /* File offset of START */
+  size_t read_bytes;            /* Bytes of file data from START,
+                                   the rest of the area is zero */
+  uint32_t flag;                /* Type and property bits of pages */
+  int advice;                   /* MADV_* access pattern, see
+                                   vma_advise () */
+  struct list_elem elem;        /* Element in thread's vma_list */
+};
+
+struct vma *
+vma_add (void *, size_t, struct file *, off_t, size_t, uint32_t);
+
+void
+vma_remove (struct vma *);
+
+void
+vma_destroy (void);
+
+bool
+vma_fork (struct thread *);
+
+struct vma *
+vma_find (const void *);
+
+bool
+vma_overlaps (const void *, size_t);
+
+bool
+vma_track_page (void *);
+
+void
+vma_advise (const void *, size_t, int);
+
+#endif /* vm/vma.h */